@@ -5,6 +5,18 @@
 #include <stdint.h>
 #include <string.h>
 #include <ctype.h>
+#include <errno.h>
+#include <dirent.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <stdatomic.h>
+#ifdef FAT16_WITH_ZLIB
+#include <zlib.h>
+#endif
+#ifdef FAT16_WITH_ZSTD
+#include <zstd.h>
+#endif
 
 // Define the structure for Boot Sector and BIOS Parameter Block
 typedef struct __attribute__((__packed__))
@@ -51,7 +63,7 @@ typedef struct __attribute__((__packed__))
 typedef struct __attribute__((__packed__))
 {
   char DIR_Name[256];
-  char shortDIR_Name[11];
+  char shortDIR_Name[13]; // Short name as NAME.EXT
   char DIR_Attr;
   char decodedAttributes[6];
   uint16_t DIR_FstClusLO;
@@ -62,6 +74,7 @@ typedef struct __attribute__((__packed__))
   int day;
   int month;
   int year;
+  uint8_t deleted; // Whether the entry was deleted (only decoded when recovering)
 } FullDirectoryEntry;
 
 typedef struct __attribute__((__packed__))
@@ -108,608 +121,3237 @@ typedef union
   LongDirectoryEntry longDirEntry;
 } EntryUnion;
 
+// Maximum number of LFN entries collected for one name
+#define MAX_NAME_PARTS 50
+
+// Structure for an open directory, decoded one cluster at a time
+typedef struct
+{
+  Volume *volume;                     // Volume the directory belongs to
+  uint16_t firstCluster;              // First cluster, 0 for the root directory
+  size_t nextCluster;                 // Next cluster of the chain to read
+  size_t clustersRead;                // Number of clusters read so far
+  off_t rootOffset;                   // Root directory: offset of the next piece to read
+  size_t rootEntriesLeft;             // Root directory: entries not read yet
+  DirectoryEntry *entries;            // Raw entries of the cluster in memory
+  size_t entryCount;                  // Number of entries in memory
+  size_t entryIndex;                  // Next entry to decode
+  int includeDeleted;                 // Whether deleted entries are returned
+  int finished;                       // Set once the end of the directory is reached
+  char nameParts[MAX_NAME_PARTS][14]; // Long name parts waiting for their short entry
+  int namePartsCount;                 // Number of waiting long name parts
+  uint8_t namePartsDeleted;           // Whether the waiting parts belong to a deleted entry
+  FullDirectoryEntry current;         // Last entry returned
+} DirectoryIterator;
+
+// Output formats supported by the listing output layer
+typedef enum
+{
+  FORMAT_TABLE, // Human readable table (default)
+  FORMAT_JSONL, // One JSON object per line
+  FORMAT_BINARY // One fixed-width ListingRecord per entry
+} OutputFormat;
+
+// Fixed-width record written for each entry in the binary output format (host byte order)
+typedef struct __attribute__((__packed__))
+{
+  uint16_t depth;         // Directory depth of the entry (0 for the root directory)
+  uint16_t parentCluster; // First cluster of the parent directory (0 for the root directory)
+  uint16_t DIR_FstClusLO; // First cluster of the entry
+  uint8_t DIR_Attr;       // Raw attribute byte
+  uint8_t reserved1;      // Always zero
+  uint32_t DIR_FileSize;  // Size of the file in bytes
+  uint16_t year;          // Last modified date and time
+  uint8_t month;
+  uint8_t day;
+  uint8_t hour;
+  uint8_t minute;
+  uint8_t second;
+  uint8_t reserved2;      // Always zero
+  char shortDIR_Name[12]; // Short name as NAME.EXT, zero padded
+  char DIR_Name[256];     // Long name, zero padded
+} ListingRecord;
+
+// Structure for a buffered output stream
+typedef struct
+{
+  int fd;          // File descriptor the buffer is flushed to
+  char *data;      // Pending output
+  size_t used;     // Number of pending bytes
+  size_t capacity; // Size of the data buffer
+} OutputBuffer;
+
+// Structure for a host file or directory collected for packing into an image
+typedef struct PackNode
+{
+  char *hostPath;            // Path of the file on the host
+  char *name;                // Long name inside the image
+  uint8_t shortName[11];     // Generated 8.3 name
+  int needsLongName;         // Whether LFN entries are written for the name
+  int isDirectory;           // Whether the node is a directory
+  uint32_t fileSize;         // Size of the file in bytes
+  time_t modifiedTime;       // Last modified time on the host
+  uint16_t firstCluster;     // First cluster of the contiguous extent
+  size_t clusterCount;       // Number of clusters in the extent
+  struct PackNode *children; // Array of directory contents
+  size_t childCount;         // Number of directory contents
+} PackNode;
+
+// Structure for a hash set of the short names used in one directory, with the next numeric tail of each basis
+typedef struct
+{
+  uint8_t (*names)[11];  // Slots holding used names, a zero first byte marks an empty slot
+  uint8_t (*bases)[11];  // Slots holding the basis names given numeric tails
+  unsigned *nextTails;   // Next tail to try for the basis in the same slot
+  size_t mask;           // Number of slots minus one (a power of two)
+} ShortNameTable;
+
+// Structure for a run of consecutive clusters
+typedef struct
+{
+  size_t firstCluster; // First cluster of the run
+  size_t clusterCount; // Number of clusters in the run
+} ClusterRun;
+
+// Structure for a file signature matched by the carving scanner
+typedef struct
+{
+  const char *extension; // Extension given to carved files
+  const char *magic;     // Bytes the file starts with
+  size_t length;         // Number of bytes in magic
+  const char *form;      // Four bytes expected at offset 8 (the RIFF form type), NULL for any
+} FileSignature;
+
+// Structure for the state of a recovery pass
+typedef struct
+{
+  uint8_t *claimedClusters;    // Free clusters already attributed to a recovered file
+  size_t clusterCount;         // Number of data clusters in the volume
+  const char *outputDirectory; // Where recovered files are written, NULL to only report them
+} RecoveryState;
+
+// Uncompressed distance between gzip access points
+#define CHUNK_SPAN (1 << 20)
+
+// Amount of history a deflate stream may refer back to
+#define GZIP_WINDOW_SIZE 32768
+
+// Number of decompressed chunks kept in memory
+#define CHUNK_CACHE_SLOTS 8
+
+// Formats of compressed images
+#define COMPRESSION_GZIP 1
+#define COMPRESSION_ZSTD 2
+
+// Structure for an entry of the chunk index of a compressed image
+typedef struct __attribute__((__packed__))
+{
+  uint64_t uncompressedOffset; // Offset of the chunk in the decompressed image
+  uint64_t compressedOffset;   // Offset in the compressed file where decompression of the chunk starts
+  uint64_t compressedSize;     // zstd: size of the frame holding the chunk
+  uint8_t bits;                // gzip: bits of the byte before compressedOffset still to be decompressed
+  uint8_t memberStart;         // gzip: the chunk starts a gzip member and needs no window
+  uint8_t reserved[6];
+} ChunkIndexEntry;
+
+// Structure for the header of a chunk index file, gzip windows follow it and the entries come last
+typedef struct __attribute__((__packed__))
+{
+  char magic[8];              // "F16CIDX1"
+  uint32_t format;            // COMPRESSION_GZIP or COMPRESSION_ZSTD
+  uint32_t chunkCount;        // Number of ChunkIndexEntry structures
+  uint64_t compressedSize;    // Size of the compressed file the index was built for
+  int64_t compressedModified; // Modification time of the compressed file the index was built for
+  uint64_t uncompressedSize;  // Size of the decompressed image
+  uint64_t entriesOffset;     // Offset of the ChunkIndexEntry array
+} ChunkIndexHeader;
+
+// Structure for a compressed image opened for random access
+typedef struct
+{
+  int openedFile;                          // File descriptor of the compressed file
+  int format;                              // COMPRESSION_GZIP or COMPRESSION_ZSTD
+  const uint8_t *compressedData;           // Mapping of the compressed file
+  size_t compressedSize;                   // Size of the compressed file
+  const uint8_t *indexData;                // Mapping of the chunk index
+  size_t indexSize;                        // Size of the chunk index
+  const ChunkIndexHeader *header;          // Header of the chunk index
+  const ChunkIndexEntry *chunks;           // Entries of the chunk index
+  uint8_t *cacheData[CHUNK_CACHE_SLOTS];   // Decompressed chunks
+  size_t cacheCapacity[CHUNK_CACHE_SLOTS]; // Size of each cache buffer
+  size_t cacheChunk[CHUNK_CACHE_SLOTS];    // Chunk held by each cache slot, SIZE_MAX if none
+  uint64_t cacheLastUse[CHUNK_CACHE_SLOTS]; // Use counter value of the last hit on each slot
+  uint64_t useCounter;                     // Counter for least recently used eviction
+} CompressedImage;
+
+// Number of spans kept per thread before the oldest are overwritten
+#define TRACE_BUFFER_EVENTS 65536
+
+// Structure for a finished span
+typedef struct
+{
+  const char *name;  // Name of the span, always a string literal
+  char detail[40];   // Optional detail such as a path component, truncated
+  int64_t argument;  // Optional number such as a cluster, -1 if unused
+  uint64_t start;    // Start time in nanoseconds
+  uint64_t duration; // Duration in nanoseconds
+} TraceEvent;
+
+// Structure for the ring buffer of spans recorded by one thread
+typedef struct TraceBuffer
+{
+  TraceEvent events[TRACE_BUFFER_EVENTS]; // Ring of spans
+  uint64_t count;                         // Number of spans ever recorded
+  int threadId;                           // Thread id shown in the trace
+  struct TraceBuffer *next;               // Next thread's buffer
+} TraceBuffer;
+
 // Constant file headers for printing
 const char *fileDetailsFormat = "%-14u   %02d:%02d:%02d             %02d/%02d/%-4d           %c%c%c%c%c%c       %-10u    %s\n";
 const char *headerFormat = "%-14s   %-15s   %-12s   %-9s   %-8s      %-s\n";
 
-// Function to read a sector from the file
-ssize_t readSector(int openedFile, void *buffer, off_t offset, size_t sectorSize)
-{
-  // Move to the specified offset
-  if (lseek(openedFile, offset, SEEK_SET) == -1)
-  {
-    perror("Error setting sector offset");
-    return -1;
-  }
+// Recursive walks add the depth and the full path of every entry
+const char *walkDetailsFormat = "%-14u   %02d:%02d:%02d             %02d/%02d/%-4d           %c%c%c%c%c%c       %-10u    %-5u   %s/%s\n";
+const char *walkHeaderFormat = "%-14s   %-15s   %-12s   %-9s   %-8s      %-5s   %-s\n";
 
-  // Read the sector into the buffer
-  ssize_t bytesRead = read(openedFile, buffer, sectorSize);
+// Global compressed image, reads of its descriptor are served from decompressed chunks
+CompressedImage *compressedImage = NULL;
 
-  if (bytesRead == -1)
+// Function to find the chunk holding an offset of the decompressed image
+size_t findChunk(const CompressedImage *image, uint64_t offset)
+{
+  size_t low = 0, high = image->header->chunkCount;
+  while (high - low > 1)
   {
-    perror("Error reading sector");
-    return -1;
+    size_t middle = (low + high) / 2;
+    if (image->chunks[middle].uncompressedOffset <= offset)
+    {
+      low = middle;
+    }
+    else
+    {
+      high = middle;
+    }
   }
+  return low;
+}
 
-  return bytesRead;
+// Function to calculate the decompressed length of a chunk
+size_t chunkLength(const CompressedImage *image, size_t chunk)
+{
+  uint64_t end = chunk + 1 < image->header->chunkCount ? image->chunks[chunk + 1].uncompressedOffset : image->header->uncompressedSize;
+  return end - image->chunks[chunk].uncompressedOffset;
 }
 
-// Function to decode the time values in a directory entry
-void extractTime(uint16_t packedTime, int *hour, int *minute, int *second)
+#ifdef FAT16_WITH_ZLIB
+// Function to refill the input of a zlib stream from a mapped file (avail_in is only 32 bits)
+void refillStream(z_stream *stream, const uint8_t *data, size_t size)
 {
-  *hour = (packedTime >> 11) & 0x1F;
-  *minute = (packedTime >> 5) & 0x3F;
-  *second = (packedTime & 0x1F) * 2;
+  if (stream->avail_in == 0)
+  {
+    size_t remaining = size - (stream->next_in - data);
+    stream->avail_in = remaining > (1u << 30) ? (1u << 30) : remaining;
+  }
 }
 
-// Function to decode a Unicode character
-char decodeUnicode(const uint8_t *unicodeChar)
+// Function to build the access points of a gzip image, windows are written to the index file as they are found
+size_t buildGzipIndex(CompressedImage *image, FILE *indexFile, ChunkIndexEntry **chunks, uint64_t *uncompressedSize)
 {
-  // Assuming the Unicode character is in ASCII range
-  if (unicodeChar[1] == 0 && isprint(unicodeChar[0]))
+  size_t chunkCount = 0, chunkCapacity = 0;
+  uint8_t *window = malloc(GZIP_WINDOW_SIZE);
+  uint8_t *linearWindow = malloc(GZIP_WINDOW_SIZE);
+  if (window == NULL || linearWindow == NULL)
   {
-    return unicodeChar[0];
+    perror("Failed to allocate memory for gzip window");
+    exit(EXIT_FAILURE);
   }
-  else
+  memset(window, 0, GZIP_WINDOW_SIZE);
+
+  z_stream stream;
+  memset(&stream, 0, sizeof(stream));
+  if (inflateInit2(&stream, 47) != Z_OK)
   {
-    return '@'; // Return random character for invalid characters
+    fprintf(stderr, "Error initialising zlib\n");
+    exit(EXIT_FAILURE);
   }
-}
+  stream.next_in = (Bytef *)image->compressedData;
+
+  uint64_t totalOut = 0, lastPoint = 0;
+  int atMemberStart = 1;
+  while (1)
+  {
+    // Decompress into a circular window so the last 32 KiB are always available
+    if (stream.avail_out == 0)
+    {
+      stream.next_out = window;
+      stream.avail_out = GZIP_WINDOW_SIZE;
+    }
+    refillStream(&stream, image->compressedData, image->compressedSize);
 
-// Temporary buffer to add and store long name entries
-char longName[256] = {0};
-int currentPos = 0;
+    // Access points are taken at the start of the first member and at deflate block boundaries
+    int blockBoundary = (stream.data_type & 128) && !(stream.data_type & 64);
+    if (chunkCount == 0 || (blockBoundary && totalOut - lastPoint >= CHUNK_SPAN))
+    {
+      if (chunkCount >= chunkCapacity)
+      {
+        chunkCapacity = chunkCapacity == 0 ? 64 : chunkCapacity * 2;
+        *chunks = realloc(*chunks, chunkCapacity * sizeof(ChunkIndexEntry));
+        if (*chunks == NULL)
+        {
+          perror("Failed to allocate memory for chunk index");
+          exit(EXIT_FAILURE);
+        }
+      }
 
-// Temporary buffer to store each part of a singular long name entry
-#define MAX_NAME_PARTS 50
-char allNameParts[MAX_NAME_PARTS][14] = {0};
-int namePartsCount = 0;
+      ChunkIndexEntry *chunk = &(*chunks)[chunkCount++];
+      memset(chunk, 0, sizeof(ChunkIndexEntry));
+      chunk->uncompressedOffset = totalOut;
+      chunk->compressedOffset = stream.next_in - image->compressedData;
+      chunk->bits = atMemberStart ? 0 : stream.data_type & 7;
+      chunk->memberStart = atMemberStart;
+
+      // Store the window in order, oldest byte first
+      size_t head = GZIP_WINDOW_SIZE - stream.avail_out;
+      memcpy(linearWindow, window + head, GZIP_WINDOW_SIZE - head);
+      memcpy(linearWindow + GZIP_WINDOW_SIZE - head, window, head);
+      if (fwrite(linearWindow, GZIP_WINDOW_SIZE, 1, indexFile) != 1)
+      {
+        perror("Error writing chunk index");
+        exit(EXIT_FAILURE);
+      }
+      lastPoint = totalOut;
+    }
+
+    uInt availableBefore = stream.avail_out;
+    int result = inflate(&stream, Z_BLOCK);
+    totalOut += availableBefore - stream.avail_out;
+    atMemberStart = 0;
 
-// Add these global pointers
-FullDirectoryEntry *fullEntry = NULL;
-size_t *clusterCheckArray = NULL;
-int *directoryNumbers = NULL;
+    if (result == Z_STREAM_END)
+    {
+      // Concatenated gzip members continue the image
+      refillStream(&stream, image->compressedData, image->compressedSize);
+      if (stream.avail_in < 2 || stream.next_in[0] != 0x1F || stream.next_in[1] != 0x8B)
+      {
+        break;
+      }
+      inflateReset(&stream);
+    }
+    else if (result != Z_OK)
+    {
+      fprintf(stderr, "Error decompressing gzip image: %s\n", stream.msg != NULL ? stream.msg : "corrupt data");
+      exit(EXIT_FAILURE);
+    }
+  }
 
-// Add these global variables to keep track of array sizes
-size_t fullEntrySize = 0;
-size_t clusterCheckArraySize = 0;
+  inflateEnd(&stream);
+  free(window);
+  free(linearWindow);
 
-// Global array to hold decoded directory entries and their count
-size_t numRootDirectoryEntries = 0;
+  *uncompressedSize = totalOut;
+  return chunkCount;
+}
 
-// Function to decode the details of a directory
-void decodeDirectoryEntry(DirectoryEntry *entry)
+// Function to decompress one chunk of a gzip image
+void decompressGzipChunk(CompressedImage *image, size_t chunk, uint8_t *output, size_t length)
 {
-  // Create a union to overlay memory
-  EntryUnion entryUnion;
-  memcpy(&entryUnion.dirEntry, entry, sizeof(DirectoryEntry));
+  const ChunkIndexEntry *entry = &image->chunks[chunk];
+  const uint8_t *window = image->indexData + sizeof(ChunkIndexHeader) + chunk * GZIP_WINDOW_SIZE;
+  int rawStream = !entry->memberStart;
 
-  // Check if the entry is a LFN entry
-  if (((entry->DIR_Attr & 0x0F) == 0x0F) || ((entry->DIR_Attr & 0x08) && (entry->DIR_Attr & 0x04)))
+  z_stream stream;
+  memset(&stream, 0, sizeof(stream));
+  if (inflateInit2(&stream, rawStream ? -15 : 47) != Z_OK)
   {
-    char namePart[14] = {0}; // Temporary buffer to store the name part
-    int partPos = 0;         // Position in the name part buffer
+    fprintf(stderr, "Error initialising zlib\n");
+    exit(EXIT_FAILURE);
+  }
+  stream.next_in = (Bytef *)image->compressedData + entry->compressedOffset;
 
-    // Decode the name parts from the LFN entry and store them in the temporary buffer
-    for (int i = 0; i < 5; i++)
+  // Restore the state of the decompressor at the access point
+  if (rawStream)
+  {
+    if (entry->bits != 0)
     {
-      namePart[partPos++] = decodeUnicode(&entryUnion.longDirEntry.LDIR_Name1[i * 2]);
+      inflatePrime(&stream, entry->bits, stream.next_in[-1] >> (8 - entry->bits));
     }
-    for (int i = 0; i < 6; i++)
+    inflateSetDictionary(&stream, window, GZIP_WINDOW_SIZE);
+  }
+
+  stream.next_out = output;
+  stream.avail_out = length;
+  while (stream.avail_out > 0)
+  {
+    refillStream(&stream, image->compressedData, image->compressedSize);
+    int result = inflate(&stream, Z_NO_FLUSH);
+
+    if (result == Z_STREAM_END)
     {
-      namePart[partPos++] = decodeUnicode(&entryUnion.longDirEntry.LDIR_Name2[i * 2]);
+      // A raw stream leaves the gzip trailer of the member behind
+      if (rawStream)
+      {
+        refillStream(&stream, image->compressedData, image->compressedSize);
+        stream.next_in += stream.avail_in < 8 ? stream.avail_in : 8;
+        stream.avail_in -= stream.avail_in < 8 ? stream.avail_in : 8;
+        inflateReset2(&stream, 47);
+        rawStream = 0;
+      }
+      else
+      {
+        inflateReset(&stream);
+      }
     }
-    for (int i = 0; i < 2; i++)
+    else if (result != Z_OK)
     {
-      namePart[partPos++] = decodeUnicode(&entryUnion.longDirEntry.LDIR_Name3[i * 2]);
+      fprintf(stderr, "Error decompressing gzip image: %s\n", stream.msg != NULL ? stream.msg : "corrupt data");
+      exit(EXIT_FAILURE);
     }
-
-    // Copy all parts of a single long name entry to temporary buffer
-    strcpy(allNameParts[namePartsCount], namePart);
-    namePartsCount++;
   }
-  else
-  {
-    // Decode attributes field
-    char attributes[6];
-    attributes[0] = (entry->DIR_Attr & 0x20) ? 'A' : '-';
-    attributes[1] = (entry->DIR_Attr & 0x10) ? 'D' : '-';
-    attributes[2] = (entry->DIR_Attr & 0x08) ? 'V' : '-';
-    attributes[3] = (entry->DIR_Attr & 0x04) ? 'S' : '-';
-    attributes[4] = (entry->DIR_Attr & 0x02) ? 'H' : '-';
-    attributes[5] = (entry->DIR_Attr & 0x01) ? 'R' : '-';
 
-    // Extracting individual components of the date and time
-    int year = ((entry->DIR_WrtDate & 0xFE00) >> 9) + 1980;
-    int month = (entry->DIR_WrtDate >> 5) & 0x0F;
-    int day = entry->DIR_WrtDate & 0x1F;
+  inflateEnd(&stream);
+}
+#endif
 
-    // Decoding time entries
-    int hour, minute, second;
-    extractTime(entry->DIR_WrtTime, &hour, &minute, &second);
+#ifdef FAT16_WITH_ZSTD
+// Function to index the frames of a zstd image, every frame is one chunk
+size_t buildZstdIndex(CompressedImage *image, ChunkIndexEntry **chunks, uint64_t *uncompressedSize)
+{
+  size_t chunkCount = 0, chunkCapacity = 0;
+  size_t position = 0;
+  uint64_t totalOut = 0;
 
-    // Appending the long name components to a combined string
-    for (int i = namePartsCount - 1; i >= 0; i--)
+  while (image->compressedSize - position >= 4)
+  {
+    const uint8_t *frame = image->compressedData + position;
+    size_t remaining = image->compressedSize - position;
+    size_t frameSize = ZSTD_findFrameCompressedSize(frame, remaining);
+    if (ZSTD_isError(frameSize))
     {
-      strcat(longName, allNameParts[i]);
+      fprintf(stderr, "Error indexing zstd image: %s\n", ZSTD_getErrorName(frameSize));
+      exit(EXIT_FAILURE);
     }
 
-    // Replace '@' with null terminator
-    for (int i = 0; longName[i] != '\0'; ++i)
+    // Skippable frames (such as a seek table) hold no image data
+    uint32_t magic;
+    memcpy(&magic, frame, sizeof(magic));
+    if ((magic & ZSTD_MAGIC_SKIPPABLE_MASK) == ZSTD_MAGIC_SKIPPABLE_START)
     {
-      if (longName[i] == '@')
-      {
-        longName[i] = '\0';
-        break; // Exit the loop when '@' is encountered
-      }
+      position += frameSize;
+      continue;
     }
 
-    // Removing white spaces in the short dir entry
-    for (size_t i = 0; i < sizeof(entry->DIR_Name); ++i)
+    unsigned long long contentSize = ZSTD_getFrameContentSize(frame, remaining);
+    if (contentSize == ZSTD_CONTENTSIZE_UNKNOWN || contentSize == ZSTD_CONTENTSIZE_ERROR)
     {
-      if (entry->DIR_Name[i] == ' ')
+      // Streamed frames do not record their size, so decompress once to measure it
+      ZSTD_DStream *dstream = ZSTD_createDStream();
+      uint8_t *scratch = malloc(CHUNK_SPAN);
+      if (dstream == NULL || scratch == NULL)
       {
-        entry->DIR_Name[i] = '\0';
-        break;
+        perror("Failed to allocate memory for zstd stream");
+        exit(EXIT_FAILURE);
+      }
+      ZSTD_inBuffer input = {frame, frameSize, 0};
+      contentSize = 0;
+      size_t result = 1;
+      while (result != 0 && input.pos < input.size)
+      {
+        ZSTD_outBuffer outputBuffer = {scratch, CHUNK_SPAN, 0};
+        result = ZSTD_decompressStream(dstream, &outputBuffer, &input);
+        if (ZSTD_isError(result))
+        {
+          fprintf(stderr, "Error decompressing zstd image: %s\n", ZSTD_getErrorName(result));
+          exit(EXIT_FAILURE);
+        }
+        contentSize += outputBuffer.pos;
       }
+      ZSTD_freeDStream(dstream);
+      free(scratch);
     }
 
-    // In case that longName isnt executed
-    if (longName[0] == 0)
+    if (chunkCount >= chunkCapacity)
     {
-      // Copy entry->DIR_Name to longName
-      strcpy((char *)longName, (const char *)entry->DIR_Name);
+      chunkCapacity = chunkCapacity == 0 ? 64 : chunkCapacity * 2;
+      *chunks = realloc(*chunks, chunkCapacity * sizeof(ChunkIndexEntry));
+      if (*chunks == NULL)
+      {
+        perror("Failed to allocate memory for chunk index");
+        exit(EXIT_FAILURE);
+      }
     }
 
-    // Copy all the decoded entries to the global array holding all of them
-    strcpy(fullEntry[numRootDirectoryEntries].DIR_Name, longName);
-    strcpy(fullEntry[numRootDirectoryEntries].shortDIR_Name, (char *)entry->DIR_Name);
-    fullEntry[numRootDirectoryEntries].DIR_Attr = entry->DIR_Attr;
-    for (int i = 0; i < 6; ++i)
-    {
-      fullEntry[numRootDirectoryEntries].decodedAttributes[i] = attributes[i];
-    }
-    fullEntry[numRootDirectoryEntries].DIR_FstClusLO = entry->DIR_FstClusLO;
-    fullEntry[numRootDirectoryEntries].DIR_FileSize = entry->DIR_FileSize;
-    fullEntry[numRootDirectoryEntries].hour = hour;
-    fullEntry[numRootDirectoryEntries].minute = minute;
-    fullEntry[numRootDirectoryEntries].second = second;
-    fullEntry[numRootDirectoryEntries].day = day;
-    fullEntry[numRootDirectoryEntries].month = month;
-    fullEntry[numRootDirectoryEntries].year = year;
-    numRootDirectoryEntries++;
+    ChunkIndexEntry *chunk = &(*chunks)[chunkCount++];
+    memset(chunk, 0, sizeof(ChunkIndexEntry));
+    chunk->uncompressedOffset = totalOut;
+    chunk->compressedOffset = position;
+    chunk->compressedSize = frameSize;
 
-    // Reseting the temporary buffer
-    memset(longName, 0, sizeof(longName));
-    currentPos = 0;
+    totalOut += contentSize;
+    position += frameSize;
+  }
+
+  *uncompressedSize = totalOut;
+  return chunkCount;
+}
 
-    // Reset the nameParts array to zero
-    namePartsCount = 0;
-    memset(allNameParts, 0, sizeof(allNameParts));
+// Function to decompress one chunk (frame) of a zstd image
+void decompressZstdChunk(CompressedImage *image, size_t chunk, uint8_t *output, size_t length)
+{
+  const ChunkIndexEntry *entry = &image->chunks[chunk];
+  size_t result = ZSTD_decompress(output, length, image->compressedData + entry->compressedOffset, entry->compressedSize);
+  if (ZSTD_isError(result) || result != length)
+  {
+    fprintf(stderr, "Error decompressing zstd image: %s\n", ZSTD_isError(result) ? ZSTD_getErrorName(result) : "short frame");
+    exit(EXIT_FAILURE);
   }
 }
+#endif
 
-// Function to print out directory entries
-void printFile(const FullDirectoryEntry *entry)
+// Function to write a new chunk index next to a compressed image
+void buildChunkIndex(CompressedImage *image, const char *indexPath, const struct stat *status)
 {
-  printf(fileDetailsFormat,
-         entry->DIR_FstClusLO, entry->hour, entry->minute, entry->second, entry->day, entry->month, entry->year,
-         entry->decodedAttributes[0], entry->decodedAttributes[1], entry->decodedAttributes[2],
-         entry->decodedAttributes[3], entry->decodedAttributes[4], entry->decodedAttributes[5],
-         entry->DIR_FileSize,
-         entry->DIR_Name);
+  // Write to a temporary name and rename it, falling back to an anonymous file if the directory is read only
+  size_t pathLength = strlen(indexPath) + 5;
+  char *temporaryPath = malloc(pathLength);
+  if (temporaryPath == NULL)
+  {
+    perror("Failed to allocate memory for path");
+    exit(EXIT_FAILURE);
+  }
+  snprintf(temporaryPath, pathLength, "%s.tmp", indexPath);
+  FILE *indexFile = fopen(temporaryPath, "w+b");
+  if (indexFile == NULL)
+  {
+    fprintf(stderr, "Cannot store chunk index %s, keeping it in a temporary file\n", indexPath);
+    indexFile = tmpfile();
+    if (indexFile == NULL)
+    {
+      perror("Error creating chunk index");
+      exit(EXIT_FAILURE);
+    }
+  }
+
+  ChunkIndexHeader header;
+  memset(&header, 0, sizeof(header));
+  if (fwrite(&header, sizeof(header), 1, indexFile) != 1)
+  {
+    perror("Error writing chunk index");
+    exit(EXIT_FAILURE);
+  }
+
+  ChunkIndexEntry *chunks = NULL;
+  size_t chunkCount = 0;
+  uint64_t uncompressedSize = 0;
+#ifdef FAT16_WITH_ZLIB
+  if (image->format == COMPRESSION_GZIP)
+  {
+    chunkCount = buildGzipIndex(image, indexFile, &chunks, &uncompressedSize);
+  }
+#endif
+#ifdef FAT16_WITH_ZSTD
+  if (image->format == COMPRESSION_ZSTD)
+  {
+    chunkCount = buildZstdIndex(image, &chunks, &uncompressedSize);
+  }
+#endif
+
+  if (chunkCount == 0)
+  {
+    fprintf(stderr, "Compressed image holds no data\n");
+    exit(EXIT_FAILURE);
+  }
+
+  memcpy(header.magic, "F16CIDX1", sizeof(header.magic));
+  header.format = image->format;
+  header.chunkCount = chunkCount;
+  header.compressedSize = status->st_size;
+  header.compressedModified = status->st_mtime;
+  header.uncompressedSize = uncompressedSize;
+  header.entriesOffset = ftell(indexFile);
+
+  if ((chunkCount > 0 && fwrite(chunks, sizeof(ChunkIndexEntry), chunkCount, indexFile) != chunkCount) ||
+      fseek(indexFile, 0, SEEK_SET) != 0 ||
+      fwrite(&header, sizeof(header), 1, indexFile) != 1 ||
+      fflush(indexFile) != 0)
+  {
+    perror("Error writing chunk index");
+    exit(EXIT_FAILURE);
+  }
+  free(chunks);
+
+  // Map the finished index, the descriptor stays valid after the rename
+  struct stat indexStatus;
+  fstat(fileno(indexFile), &indexStatus);
+  image->indexSize = indexStatus.st_size;
+  image->indexData = mmap(NULL, image->indexSize, PROT_READ, MAP_PRIVATE, fileno(indexFile), 0);
+  if (image->indexData == MAP_FAILED)
+  {
+    perror("Error mapping chunk index");
+    exit(EXIT_FAILURE);
+  }
+  rename(temporaryPath, indexPath);
+  fclose(indexFile);
+  free(temporaryPath);
 }
 
-// Function to loop through a directory and extract its contents
-void processDirectoryEntries(int openedFile, off_t rootDirStart, size_t numEntries)
+// Function to check that a mapped chunk index only points inside itself and the compressed image
+int validChunkIndex(const CompressedImage *image)
 {
-  // Read each directory entry
-  for (size_t i = 0; i < numEntries; ++i)
+  const ChunkIndexHeader *header = (const ChunkIndexHeader *)image->indexData;
+
+  // The entries must fit behind the header (and the gzip windows), compared without overflowing
+  if (header->chunkCount == 0 ||
+      header->entriesOffset < sizeof(ChunkIndexHeader) ||
+      header->entriesOffset > image->indexSize ||
+      header->chunkCount > (image->indexSize - header->entriesOffset) / sizeof(ChunkIndexEntry) ||
+      (header->format == COMPRESSION_GZIP &&
+       header->chunkCount > (header->entriesOffset - sizeof(ChunkIndexHeader)) / GZIP_WINDOW_SIZE))
   {
-    DirectoryEntry entry;
-    readSector(openedFile, &entry, rootDirStart + i * sizeof(DirectoryEntry), sizeof(DirectoryEntry));
+    return 0;
+  }
 
-    // Check if the entry is a valid file or directory
-    if ((entry.DIR_Name[0] == 0x00))
+  // Chunks must start inside the compressed image and cover the decompressed image in order
+  const ChunkIndexEntry *chunks = (const ChunkIndexEntry *)(image->indexData + header->entriesOffset);
+  for (size_t i = 0; i < header->chunkCount; i++)
+  {
+    const ChunkIndexEntry *chunk = &chunks[i];
+    uint64_t previousOffset = i > 0 ? chunks[i - 1].uncompressedOffset : 0;
+    if (chunk->compressedOffset >= image->compressedSize ||
+        (i == 0 ? chunk->uncompressedOffset != 0 : chunk->uncompressedOffset <= previousOffset) ||
+        (i > 0 && chunk->uncompressedOffset >= header->uncompressedSize))
     {
-      return;
+      return 0;
     }
-    else if (entry.DIR_Name[0] == 0xE5)
+    if (header->format == COMPRESSION_GZIP &&
+        (chunk->bits > 7 || (chunk->bits != 0 && chunk->compressedOffset == 0)))
     {
-      continue;
+      return 0;
     }
-
-    // Inside the loop where entries are processed:
-    if (numRootDirectoryEntries >= fullEntrySize)
+    if (header->format == COMPRESSION_ZSTD &&
+        chunk->compressedSize > image->compressedSize - chunk->compressedOffset)
     {
-      fullEntrySize = fullEntrySize == 0 ? 1000 : fullEntrySize * 2;
-      fullEntry = realloc(fullEntry, fullEntrySize * sizeof(FullDirectoryEntry));
-      if (fullEntry == NULL)
-      {
-        perror("Failed to allocate memory for fullEntry");
-        exit(EXIT_FAILURE);
-      }
+      return 0;
     }
-
-    // Pass the entry to be decoded
-    decodeDirectoryEntry(&entry);
   }
+
+  return 1;
 }
 
-// Function to calculate byte offset for a given cluster
-off_t calculateByteOffset(uint16_t clusterNumber, uint16_t bytesPerCluster, off_t dataAreaStart)
+// Function to map an existing chunk index, returns 0 if it is missing or does not match the image
+int loadChunkIndex(CompressedImage *image, const char *indexPath, const struct stat *status)
 {
-  // Subtract 2 because cluster numbers start from 2 in FAT systems
-  return (clusterNumber - 2) * bytesPerCluster + dataAreaStart;
+  int indexFile = open(indexPath, O_RDONLY);
+  if (indexFile == -1)
+  {
+    return 0;
+  }
+
+  struct stat indexStatus;
+  if (fstat(indexFile, &indexStatus) == -1 || (size_t)indexStatus.st_size < sizeof(ChunkIndexHeader))
+  {
+    close(indexFile);
+    return 0;
+  }
+
+  image->indexSize = indexStatus.st_size;
+  image->indexData = mmap(NULL, image->indexSize, PROT_READ, MAP_PRIVATE, indexFile, 0);
+  close(indexFile);
+  if (image->indexData == MAP_FAILED)
+  {
+    return 0;
+  }
+
+  const ChunkIndexHeader *header = (const ChunkIndexHeader *)image->indexData;
+  if (memcmp(header->magic, "F16CIDX1", sizeof(header->magic)) != 0 ||
+      header->format != (uint32_t)image->format ||
+      header->compressedSize != (uint64_t)status->st_size ||
+      header->compressedModified != (int64_t)status->st_mtime ||
+      !validChunkIndex(image))
+  {
+    munmap((void *)image->indexData, image->indexSize);
+    return 0;
+  }
+
+  return 1;
 }
 
-// Function to create a volume structure
-Volume *createVolume(int openedFile, BootSector *bootEntries, uint16_t *fatEntries, size_t fatSize, off_t dataAreaStart)
+// Function to open an image as a compressed image, returns NULL if it is not compressed
+CompressedImage *openCompressedImage(int openedFile, const char *filePath)
 {
-  Volume *volume = malloc(sizeof(Volume));
-  if (volume == NULL)
+  uint8_t magic[4] = {0};
+  if (pread(openedFile, magic, sizeof(magic), 0) != sizeof(magic))
   {
-    perror("Error allocating memory for Volume structure");
-    close(openedFile);
+    return NULL;
+  }
+
+  int format;
+  if (magic[0] == 0x1F && magic[1] == 0x8B)
+  {
+    format = COMPRESSION_GZIP;
+#ifndef FAT16_WITH_ZLIB
+    fprintf(stderr, "%s is gzip compressed, rebuild with -DFAT16_WITH_ZLIB -lz to read it\n", filePath);
+    exit(EXIT_FAILURE);
+#endif
+  }
+  else if (magic[0] == 0x28 && magic[1] == 0xB5 && magic[2] == 0x2F && magic[3] == 0xFD)
+  {
+    format = COMPRESSION_ZSTD;
+#ifndef FAT16_WITH_ZSTD
+    fprintf(stderr, "%s is zstd compressed, rebuild with -DFAT16_WITH_ZSTD -lzstd to read it\n", filePath);
     exit(EXIT_FAILURE);
+#endif
+  }
+  else
+  {
+    return NULL;
   }
 
-  volume->openedFile = openedFile;
-  volume->bootEntries = bootEntries;
-  volume->fatEntries = fatEntries;
-  volume->fatSize = fatSize;
-  volume->dataAreaStart = dataAreaStart;
+  CompressedImage *image = calloc(1, sizeof(CompressedImage));
+  struct stat status;
+  if (image == NULL || fstat(openedFile, &status) == -1)
+  {
+    perror("Error opening compressed image");
+    exit(EXIT_FAILURE);
+  }
+  image->openedFile = openedFile;
+  image->format = format;
 
-  return volume;
+  // The whole compressed file is mapped, only the pages of the chunks read are ever touched
+  image->compressedSize = status.st_size;
+  image->compressedData = mmap(NULL, image->compressedSize, PROT_READ, MAP_PRIVATE, openedFile, 0);
+  if (image->compressedData == MAP_FAILED)
+  {
+    perror("Error mapping compressed image");
+    exit(EXIT_FAILURE);
+  }
+
+  // The index is stored alongside the image and rebuilt when the image changes
+  size_t pathLength = strlen(filePath) + 5;
+  char *indexPath = malloc(pathLength);
+  if (indexPath == NULL)
+  {
+    perror("Failed to allocate memory for path");
+    exit(EXIT_FAILURE);
+  }
+  snprintf(indexPath, pathLength, "%s.idx", filePath);
+  if (!loadChunkIndex(image, indexPath, &status))
+  {
+    buildChunkIndex(image, indexPath, &status);
+  }
+  free(indexPath);
+
+  image->header = (const ChunkIndexHeader *)image->indexData;
+  image->chunks = (const ChunkIndexEntry *)(image->indexData + image->header->entriesOffset);
+  for (int i = 0; i < CHUNK_CACHE_SLOTS; i++)
+  {
+    image->cacheChunk[i] = SIZE_MAX;
+  }
+
+  return image;
 }
 
-// Open a file and return a File structure
-File *openFile(Volume *volume, FullDirectoryEntry *entry)
+// Function to get a decompressed chunk, from the cache if possible
+const uint8_t *getChunk(CompressedImage *image, size_t chunk)
 {
-  File *file = malloc(sizeof(File));
+  // Look for the chunk, remembering the least recently used slot
+  int slot = 0;
+  for (int i = 0; i < CHUNK_CACHE_SLOTS; i++)
+  {
+    if (image->cacheChunk[i] == chunk)
+    {
+      image->cacheLastUse[i] = ++image->useCounter;
+      return image->cacheData[i];
+    }
+    if (image->cacheLastUse[i] < image->cacheLastUse[slot])
+    {
+      slot = i;
+    }
+  }
 
-  file->openedFile = volume->openedFile;
-  file->bootEntries = volume->bootEntries;
-  file->fatEntries = volume->fatEntries;
-  file->fatSize = volume->fatSize;
-  file->dataAreaStart = volume->dataAreaStart;
-  file->currentClusterOffset = 0;
-  file->currentCluster = entry->DIR_FstClusLO;
-  file->clusterArray = NULL; // Initialize to NULL initially
-  file->clusterArraySize = 0;
-  file->fileSize = entry->DIR_FileSize;
+  size_t length = chunkLength(image, chunk);
+  if (length > image->cacheCapacity[slot])
+  {
+    free(image->cacheData[slot]);
+    image->cacheData[slot] = malloc(length);
+    if (image->cacheData[slot] == NULL)
+    {
+      perror("Failed to allocate memory for chunk cache");
+      exit(EXIT_FAILURE);
+    }
+    image->cacheCapacity[slot] = length;
+  }
+
+#ifdef FAT16_WITH_ZLIB
+  if (image->format == COMPRESSION_GZIP)
+  {
+    decompressGzipChunk(image, chunk, image->cacheData[slot], length);
+  }
+#endif
+#ifdef FAT16_WITH_ZSTD
+  if (image->format == COMPRESSION_ZSTD)
+  {
+    decompressZstdChunk(image, chunk, image->cacheData[slot], length);
+  }
+#endif
+
+  image->cacheChunk[slot] = chunk;
+  image->cacheLastUse[slot] = ++image->useCounter;
+  return image->cacheData[slot];
+}
+
+// Function to read from the decompressed image, decompressing only the chunks touched
+ssize_t readCompressedImage(CompressedImage *image, void *buffer, off_t offset, size_t length)
+{
+  size_t bytesRead = 0;
+
+  while (bytesRead < length && (uint64_t)offset + bytesRead < image->header->uncompressedSize)
+  {
+    uint64_t position = offset + bytesRead;
+    size_t chunk = findChunk(image, position);
+    const uint8_t *data = getChunk(image, chunk);
+
+    size_t chunkOffset = position - image->chunks[chunk].uncompressedOffset;
+    size_t available = chunkLength(image, chunk) - chunkOffset;
+    size_t bytesToCopy = length - bytesRead < available ? length - bytesRead : available;
+
+    memcpy((char *)buffer + bytesRead, data + chunkOffset, bytesToCopy);
+    bytesRead += bytesToCopy;
+  }
+
+  return bytesRead;
+}
+
+// Function to release a compressed image
+void closeCompressedImage(CompressedImage *image)
+{
+  for (int i = 0; i < CHUNK_CACHE_SLOTS; i++)
+  {
+    free(image->cacheData[i]);
+  }
+  munmap((void *)image->compressedData, image->compressedSize);
+  munmap((void *)image->indexData, image->indexSize);
+  free(image);
+}
+
+// Function to read a sector from the file
+ssize_t readSector(int openedFile, void *buffer, off_t offset, size_t sectorSize)
+{
+  // Compressed images are served from decompressed chunks
+  if (compressedImage != NULL && openedFile == compressedImage->openedFile)
+  {
+    return readCompressedImage(compressedImage, buffer, offset, sectorSize);
+  }
+
+  // Move to the specified offset
+  if (lseek(openedFile, offset, SEEK_SET) == -1)
+  {
+    perror("Error setting sector offset");
+    return -1;
+  }
+
+  // Read the sector into the buffer
+  ssize_t bytesRead = read(openedFile, buffer, sectorSize);
+
+  if (bytesRead == -1)
+  {
+    perror("Error reading sector");
+    return -1;
+  }
+
+  return bytesRead;
+}
+
+// Function to decode the time values in a directory entry
+void extractTime(uint16_t packedTime, int *hour, int *minute, int *second)
+{
+  *hour = (packedTime >> 11) & 0x1F;
+  *minute = (packedTime >> 5) & 0x3F;
+  *second = (packedTime & 0x1F) * 2;
+}
+
+// Function to decode a Unicode character
+char decodeUnicode(const uint8_t *unicodeChar)
+{
+  // Assuming the Unicode character is in ASCII range
+  if (unicodeChar[1] == 0 && isprint(unicodeChar[0]))
+  {
+    return unicodeChar[0];
+  }
+  else
+  {
+    return '@'; // Return random character for invalid characters
+  }
+}
+
+// Function to check if a directory entry is a LFN entry
+int isLongNameEntry(const DirectoryEntry *entry)
+{
+  return ((entry->DIR_Attr & 0x0F) == 0x0F) || ((entry->DIR_Attr & 0x08) && (entry->DIR_Attr & 0x04));
+}
+
+// Function to decode the part of a long name held by a LFN entry
+void decodeLongNamePart(const DirectoryEntry *entry, char *namePart)
+{
+  // Create a union to overlay memory
+  EntryUnion entryUnion;
+  memcpy(&entryUnion.dirEntry, entry, sizeof(DirectoryEntry));
+
+  int partPos = 0; // Position in the name part buffer
+
+  // Decode the name parts from the LFN entry and store them in the buffer
+  for (int i = 0; i < 5; i++)
+  {
+    namePart[partPos++] = decodeUnicode(&entryUnion.longDirEntry.LDIR_Name1[i * 2]);
+  }
+  for (int i = 0; i < 6; i++)
+  {
+    namePart[partPos++] = decodeUnicode(&entryUnion.longDirEntry.LDIR_Name2[i * 2]);
+  }
+  for (int i = 0; i < 2; i++)
+  {
+    namePart[partPos++] = decodeUnicode(&entryUnion.longDirEntry.LDIR_Name3[i * 2]);
+  }
+  namePart[partPos] = '\0';
+}
+
+// Function to decode the details of a short directory entry, named by the long name parts read before it
+void decodeDirectoryEntry(const DirectoryEntry *entry, char nameParts[][14], int namePartsCount, FullDirectoryEntry *decoded)
+{
+  // Decode attributes field
+  char attributes[6];
+  attributes[0] = (entry->DIR_Attr & 0x20) ? 'A' : '-';
+  attributes[1] = (entry->DIR_Attr & 0x10) ? 'D' : '-';
+  attributes[2] = (entry->DIR_Attr & 0x08) ? 'V' : '-';
+  attributes[3] = (entry->DIR_Attr & 0x04) ? 'S' : '-';
+  attributes[4] = (entry->DIR_Attr & 0x02) ? 'H' : '-';
+  attributes[5] = (entry->DIR_Attr & 0x01) ? 'R' : '-';
+
+  // Extracting individual components of the date and time
+  int year = ((entry->DIR_WrtDate & 0xFE00) >> 9) + 1980;
+  int month = (entry->DIR_WrtDate >> 5) & 0x0F;
+  int day = entry->DIR_WrtDate & 0x1F;
+
+  // Decoding time entries
+  int hour, minute, second;
+  extractTime(entry->DIR_WrtTime, &hour, &minute, &second);
+
+  // Appending the long name components to a combined string, the last part comes first on disk
+  char longName[256] = {0};
+  size_t longNameLength = 0;
+  for (int i = namePartsCount - 1; i >= 0; i--)
+  {
+    for (int j = 0; nameParts[i][j] != '\0' && longNameLength < sizeof(longName) - 1; j++)
+    {
+      longName[longNameLength++] = nameParts[i][j];
+    }
+  }
+
+  // Replace '@' with null terminator
+  for (int i = 0; longName[i] != '\0'; ++i)
+  {
+    if (longName[i] == '@')
+    {
+      longName[i] = '\0';
+      break; // Exit the loop when '@' is encountered
+    }
+  }
+
+  // Build the short name as NAME.EXT, without the space padding
+  char shortName[13];
+  size_t shortNameLength = 0;
+  if (entry->DIR_Attr & 0x08)
+  {
+    // Volume labels are one 11 character field that may contain spaces
+    shortNameLength = sizeof(entry->DIR_Name);
+    while (shortNameLength > 0 && entry->DIR_Name[shortNameLength - 1] == ' ')
+    {
+      shortNameLength--;
+    }
+    memcpy(shortName, entry->DIR_Name, shortNameLength);
+  }
+  else
+  {
+    for (size_t i = 0; i < 8 && entry->DIR_Name[i] != ' '; i++)
+    {
+      shortName[shortNameLength++] = entry->DIR_Name[i];
+    }
+    if (entry->DIR_Name[8] != ' ')
+    {
+      shortName[shortNameLength++] = '.';
+      for (size_t i = 8; i < 11 && entry->DIR_Name[i] != ' '; i++)
+      {
+        shortName[shortNameLength++] = entry->DIR_Name[i];
+      }
+    }
+  }
+  shortName[shortNameLength] = '\0';
+
+  // In case that longName isnt executed
+  if (longName[0] == 0)
+  {
+    strcpy(longName, shortName);
+  }
+
+  // Copy all the decoded values to the caller's entry
+  memset(decoded, 0, sizeof(FullDirectoryEntry));
+  strcpy(decoded->DIR_Name, longName);
+  strcpy(decoded->shortDIR_Name, shortName);
+  decoded->DIR_Attr = entry->DIR_Attr;
+  for (int i = 0; i < 6; ++i)
+  {
+    decoded->decodedAttributes[i] = attributes[i];
+  }
+  decoded->DIR_FstClusLO = entry->DIR_FstClusLO;
+  decoded->DIR_FileSize = entry->DIR_FileSize;
+  decoded->hour = hour;
+  decoded->minute = minute;
+  decoded->second = second;
+  decoded->day = day;
+  decoded->month = month;
+  decoded->year = year;
+}
+
+// Size of the buffer used for listing output and image writes
+#define OUTPUT_BUFFER_SIZE (1 << 20)
+
+// Global output stream and format used for listings
+OutputBuffer standardOutput = {STDOUT_FILENO, NULL, 0, 0};
+OutputFormat outputFormat = FORMAT_TABLE;
+
+// Whether table listings show the depth and full path of entries (set for recursive walks)
+int tableShowsPath = 0;
+
+// Function to write a whole buffer to a file descriptor
+void writeAll(int fd, const void *data, size_t length)
+{
+  size_t written = 0;
+  while (written < length)
+  {
+    ssize_t result = write(fd, (const char *)data + written, length - written);
+    if (result == -1)
+    {
+      if (errno == EINTR)
+      {
+        continue;
+      }
+      perror("Error writing output");
+      exit(EXIT_FAILURE);
+    }
+    written += result;
+  }
+}
+
+// Function to write out everything pending in an output buffer
+void outputFlush(OutputBuffer *output)
+{
+  // Keep anything printed through stdio before the buffered data in order
+  if (output->fd == STDOUT_FILENO)
+  {
+    fflush(stdout);
+  }
+
+  writeAll(output->fd, output->data, output->used);
+  output->used = 0;
+}
+
+// Function to reserve space for length bytes at the end of an output buffer
+char *outputReserve(OutputBuffer *output, size_t length)
+{
+  if (output->used + length > output->capacity)
+  {
+    outputFlush(output);
+
+    // Grow the buffer if a single write does not fit
+    if (length > output->capacity)
+    {
+      output->capacity = length > OUTPUT_BUFFER_SIZE ? length : OUTPUT_BUFFER_SIZE;
+      output->data = realloc(output->data, output->capacity);
+      if (output->data == NULL)
+      {
+        perror("Failed to allocate memory for output buffer");
+        exit(EXIT_FAILURE);
+      }
+    }
+  }
+
+  return output->data + output->used;
+}
+
+// Function to append bytes to an output buffer
+void outputWrite(OutputBuffer *output, const void *data, size_t length)
+{
+  // Large blocks bypass the buffer
+  if (length >= OUTPUT_BUFFER_SIZE)
+  {
+    outputFlush(output);
+    writeAll(output->fd, data, length);
+    return;
+  }
+
+  memcpy(outputReserve(output, length), data, length);
+  output->used += length;
+}
+
+// Function to format an unsigned number, zero padded to at least width digits
+char *formatUnsigned(char *out, uint32_t value, int width)
+{
+  char digits[10];
+  int count = 0;
+
+  do
+  {
+    digits[count++] = '0' + value % 10;
+    value /= 10;
+  } while (value != 0);
+
+  while (width-- > count)
+  {
+    *out++ = '0';
+  }
+  while (count > 0)
+  {
+    *out++ = digits[--count];
+  }
+
+  return out;
+}
+
+// Function to copy a string into JSON, escaping anything outside printable ASCII
+char *formatJsonText(char *out, const char *text, size_t length)
+{
+  static const char hexDigits[] = "0123456789abcdef";
+
+  for (size_t i = 0; i < length && text[i] != '\0'; i++)
+  {
+    uint8_t c = text[i];
+    if (c == '"' || c == '\\')
+    {
+      *out++ = '\\';
+      *out++ = c;
+    }
+    else if (c < 0x20 || c >= 0x7F)
+    {
+      memcpy(out, "\\u00", 4);
+      out[4] = hexDigits[c >> 4];
+      out[5] = hexDigits[c & 0x0F];
+      out += 6;
+    }
+    else
+    {
+      *out++ = c;
+    }
+  }
+
+  return out;
+}
+
+// Function to copy a string literal without its terminator
+char *formatLiteral(char *out, const char *text)
+{
+  size_t length = strlen(text);
+  memcpy(out, text, length);
+  return out + length;
+}
+
+// Function to write a decoded directory entry to an output buffer in the selected format
+void outputEntry(OutputBuffer *output, const FullDirectoryEntry *entry, const char *parentPath, uint16_t parentCluster, uint16_t depth)
+{
+  size_t nameLength = strnlen(entry->DIR_Name, sizeof(entry->DIR_Name));
+  size_t shortLength = strnlen(entry->shortDIR_Name, sizeof(entry->shortDIR_Name));
+
+  if (outputFormat == FORMAT_BINARY)
+  {
+    ListingRecord *record = (ListingRecord *)outputReserve(output, sizeof(ListingRecord));
+    memset(record, 0, sizeof(ListingRecord));
+    record->depth = depth;
+    record->parentCluster = parentCluster;
+    record->DIR_FstClusLO = entry->DIR_FstClusLO;
+    record->DIR_Attr = entry->DIR_Attr;
+    record->DIR_FileSize = entry->DIR_FileSize;
+    record->year = entry->year;
+    record->month = entry->month;
+    record->day = entry->day;
+    record->hour = entry->hour;
+    record->minute = entry->minute;
+    record->second = entry->second;
+    memcpy(record->shortDIR_Name, entry->shortDIR_Name, shortLength);
+    memcpy(record->DIR_Name, entry->DIR_Name, nameLength);
+    output->used += sizeof(ListingRecord);
+  }
+  else if (outputFormat == FORMAT_JSONL)
+  {
+    // Every character may expand to a six byte escape
+    size_t parentLength = strlen(parentPath);
+    char *start = outputReserve(output, 256 + 6 * (parentLength + 2 * nameLength + shortLength));
+    char *out = start;
+
+    out = formatLiteral(out, "{\"path\":\"");
+    out = formatJsonText(out, parentPath, parentLength);
+    *out++ = '/';
+    out = formatJsonText(out, entry->DIR_Name, nameLength);
+    out = formatLiteral(out, "\",\"name\":\"");
+    out = formatJsonText(out, entry->DIR_Name, nameLength);
+    out = formatLiteral(out, "\",\"short\":\"");
+    out = formatJsonText(out, entry->shortDIR_Name, shortLength);
+    out = formatLiteral(out, "\",\"attr\":\"");
+    memcpy(out, entry->decodedAttributes, sizeof(entry->decodedAttributes));
+    out += sizeof(entry->decodedAttributes);
+    out = formatLiteral(out, "\",\"cluster\":");
+    out = formatUnsigned(out, entry->DIR_FstClusLO, 1);
+    out = formatLiteral(out, ",\"size\":");
+    out = formatUnsigned(out, entry->DIR_FileSize, 1);
+    out = formatLiteral(out, ",\"modified\":\"");
+    out = formatUnsigned(out, entry->year, 4);
+    *out++ = '-';
+    out = formatUnsigned(out, entry->month, 2);
+    *out++ = '-';
+    out = formatUnsigned(out, entry->day, 2);
+    *out++ = 'T';
+    out = formatUnsigned(out, entry->hour, 2);
+    *out++ = ':';
+    out = formatUnsigned(out, entry->minute, 2);
+    *out++ = ':';
+    out = formatUnsigned(out, entry->second, 2);
+    out = formatLiteral(out, "\",\"depth\":");
+    out = formatUnsigned(out, depth, 1);
+    out = formatLiteral(out, "}\n");
+    output->used += out - start;
+  }
+  else if (tableShowsPath)
+  {
+    // Fixed columns are well under 128 characters
+    size_t length = 128 + strlen(parentPath) + nameLength;
+    char *out = outputReserve(output, length);
+    output->used += snprintf(out, length, walkDetailsFormat,
+                             entry->DIR_FstClusLO, entry->hour, entry->minute, entry->second, entry->day, entry->month, entry->year,
+                             entry->decodedAttributes[0], entry->decodedAttributes[1], entry->decodedAttributes[2],
+                             entry->decodedAttributes[3], entry->decodedAttributes[4], entry->decodedAttributes[5],
+                             entry->DIR_FileSize, depth,
+                             parentPath, entry->DIR_Name);
+  }
+  else
+  {
+    // Fixed columns are well under 128 characters
+    size_t length = 128 + nameLength;
+    char *out = outputReserve(output, length);
+    output->used += snprintf(out, length, fileDetailsFormat,
+                             entry->DIR_FstClusLO, entry->hour, entry->minute, entry->second, entry->day, entry->month, entry->year,
+                             entry->decodedAttributes[0], entry->decodedAttributes[1], entry->decodedAttributes[2],
+                             entry->decodedAttributes[3], entry->decodedAttributes[4], entry->decodedAttributes[5],
+                             entry->DIR_FileSize,
+                             entry->DIR_Name);
+  }
+}
+
+// Function to print out directory entries
+void printFile(const FullDirectoryEntry *entry, const char *parentPath, uint16_t parentCluster, uint16_t depth)
+{
+  outputEntry(&standardOutput, entry, parentPath, parentCluster, depth);
+}
+
+// Function to print the table header for a listing (machine readable formats have none)
+void printListingHeader(void)
+{
+  if (outputFormat == FORMAT_TABLE && tableShowsPath)
+  {
+    printf(walkHeaderFormat, "First Cluster", "Last Modified Time", "Last Modified Date", "Attributes", "Length", "Depth", "Path");
+    printf("--------------------------------------------------");
+    printf("------------------------------------------------------------\n");
+  }
+  else if (outputFormat == FORMAT_TABLE)
+  {
+    printf(headerFormat, "First Cluster", "Last Modified Time", "Last Modified Date", "Attributes", "Length", "FileName");
+    printf("--------------------------------------------------");
+    printf("----------------------------------------------------\n");
+  }
+}
+
+// Whether spans are recorded, and where they are written at exit
+int tracingEnabled = 0;
+const char *traceFilePath = NULL;
+
+// Ring buffer of the calling thread, and the list of every thread's ring buffer
+_Thread_local TraceBuffer *threadTraceBuffer = NULL;
+TraceBuffer *_Atomic traceBuffers = NULL;
+atomic_int nextTraceThreadId = 1;
+
+// Time tracing started, event timestamps are relative to it
+uint64_t traceStartTime = 0;
+
+// Function to read the monotonic clock in nanoseconds
+uint64_t traceNow(void)
+{
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t)now.tv_sec * 1000000000u + now.tv_nsec;
+}
+
+// Function to start a span, returns its start time
+uint64_t traceBegin(void)
+{
+  return tracingEnabled ? traceNow() : 0;
+}
+
+// Function to record a finished span in the calling thread's ring buffer
+void traceEnd(const char *name, const char *detail, int64_t argument, uint64_t start)
+{
+  if (!tracingEnabled)
+  {
+    return;
+  }
+  uint64_t end = traceNow();
+
+  // Each thread gets its own ring buffer on its first span
+  TraceBuffer *buffer = threadTraceBuffer;
+  if (buffer == NULL)
+  {
+    buffer = calloc(1, sizeof(TraceBuffer));
+    if (buffer == NULL)
+    {
+      tracingEnabled = 0;
+      return;
+    }
+    buffer->threadId = atomic_fetch_add(&nextTraceThreadId, 1);
+    buffer->next = atomic_load(&traceBuffers);
+    while (!atomic_compare_exchange_weak(&traceBuffers, &buffer->next, buffer))
+    {
+    }
+    threadTraceBuffer = buffer;
+  }
+
+  // Once the ring is full the oldest spans are overwritten
+  TraceEvent *event = &buffer->events[buffer->count % TRACE_BUFFER_EVENTS];
+  event->name = name;
+  event->start = start;
+  event->duration = end - start;
+  event->argument = argument;
+  if (detail != NULL)
+  {
+    strncpy(event->detail, detail, sizeof(event->detail) - 1);
+    event->detail[sizeof(event->detail) - 1] = '\0';
+  }
+  else
+  {
+    event->detail[0] = '\0';
+  }
+  buffer->count++;
+}
+
+// Function to write a whole buffer, returns 0 on failure instead of exiting (safe inside atexit handlers)
+int tryWriteAll(int fd, const void *data, size_t length)
+{
+  size_t written = 0;
+  while (written < length)
+  {
+    ssize_t result = write(fd, (const char *)data + written, length - written);
+    if (result == -1 && errno == EINTR)
+    {
+      continue;
+    }
+    if (result <= 0)
+    {
+      return 0;
+    }
+    written += result;
+  }
+  return 1;
+}
+
+// Function to write every recorded span as Chrome trace-event JSON, registered with atexit
+void writeTraceFile(void)
+{
+  int traceFile = open(traceFilePath, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (traceFile == -1)
+  {
+    perror("Error creating trace file");
+    return;
+  }
+  tracingEnabled = 0;
+
+  // Nothing called from an atexit handler may call exit, so the output layer is not used here
+  static char block[1 << 16];
+  size_t used = 0;
+  int pid = getpid();
+  int firstEvent = 1;
+  int ok = 1;
+
+  used += sprintf(block, "{\"traceEvents\":[\n");
+  for (TraceBuffer *buffer = atomic_load(&traceBuffers); ok && buffer != NULL; buffer = buffer->next)
+  {
+    uint64_t first = buffer->count > TRACE_BUFFER_EVENTS ? buffer->count - TRACE_BUFFER_EVENTS : 0;
+    for (uint64_t i = first; ok && i < buffer->count; i++)
+    {
+      const TraceEvent *event = &buffer->events[i % TRACE_BUFFER_EVENTS];
+      uint64_t start = event->start > traceStartTime ? event->start - traceStartTime : 0;
+
+      // Every event fits in well under 256 bytes plus its escaped detail
+      if (used + 256 + 6 * sizeof(event->detail) > sizeof(block))
+      {
+        ok = tryWriteAll(traceFile, block, used);
+        used = 0;
+      }
+
+      // Timestamps are in microseconds with nanosecond fractions
+      char *out = block + used;
+      out += sprintf(out, "%s{\"name\":\"%s\",\"cat\":\"fat16\",\"ph\":\"X\",\"ts\":%llu.%03llu,\"dur\":%llu.%03llu,\"pid\":%d,\"tid\":%d,\"args\":{",
+                     firstEvent ? "" : ",\n", event->name,
+                     (unsigned long long)(start / 1000), (unsigned long long)(start % 1000),
+                     (unsigned long long)(event->duration / 1000), (unsigned long long)(event->duration % 1000),
+                     pid, buffer->threadId);
+      if (event->detail[0] != '\0')
+      {
+        out = formatLiteral(out, "\"detail\":\"");
+        out = formatJsonText(out, event->detail, sizeof(event->detail));
+        out = formatLiteral(out, event->argument >= 0 ? "\"," : "\"");
+      }
+      if (event->argument >= 0)
+      {
+        out += sprintf(out, "\"value\":%lld", (long long)event->argument);
+      }
+      out = formatLiteral(out, "}}");
+      used = out - block;
+      firstEvent = 0;
+    }
+  }
+  used += sprintf(block + used, "\n],\"displayTimeUnit\":\"ns\"}\n");
+  if (!ok || !tryWriteAll(traceFile, block, used))
+  {
+    perror("Error writing trace file");
+  }
+
+  close(traceFile);
+}
+
+// Function to calculate byte offset for a given cluster
+off_t calculateByteOffset(uint16_t clusterNumber, uint16_t bytesPerCluster, off_t dataAreaStart)
+{
+  // Subtract 2 because cluster numbers start from 2 in FAT systems
+  return (clusterNumber - 2) * bytesPerCluster + dataAreaStart;
+}
+
+// Function to calculate the byte offset of the root directory
+off_t calculateRootDirStart(const BootSector *bootSector)
+{
+  return (bootSector->BPB_RsvdSecCnt + bootSector->BPB_NumFATs * bootSector->BPB_FATSz16) * bootSector->BPB_BytsPerSec;
+}
+
+// Function to create a volume structure
+Volume *createVolume(int openedFile, BootSector *bootEntries, uint16_t *fatEntries, size_t fatSize, off_t dataAreaStart)
+{
+  Volume *volume = malloc(sizeof(Volume));
+  if (volume == NULL)
+  {
+    perror("Error allocating memory for Volume structure");
+    close(openedFile);
+    exit(EXIT_FAILURE);
+  }
+
+  volume->openedFile = openedFile;
+  volume->bootEntries = bootEntries;
+  volume->fatEntries = fatEntries;
+  volume->fatSize = fatSize;
+  volume->dataAreaStart = dataAreaStart;
+
+  return volume;
+}
+
+// Function to open a directory for enumeration (cluster 0 is the root directory)
+DirectoryIterator *openDirectory(Volume *volume, uint16_t firstCluster, int includeDeleted)
+{
+  DirectoryIterator *directory = calloc(1, sizeof(DirectoryIterator));
+  size_t bytesPerCluster = volume->bootEntries->BPB_BytsPerSec * volume->bootEntries->BPB_SecPerClus;
+  if (directory == NULL || (directory->entries = malloc(bytesPerCluster)) == NULL)
+  {
+    perror("Failed to allocate memory for directory iterator");
+    exit(EXIT_FAILURE);
+  }
+
+  directory->volume = volume;
+  directory->firstCluster = firstCluster;
+  directory->nextCluster = firstCluster;
+  directory->includeDeleted = includeDeleted;
+
+  // The root directory is a fixed region in front of the data area, read in cluster sized pieces
+  if (firstCluster == 0)
+  {
+    directory->rootOffset = calculateRootDirStart(volume->bootEntries);
+    directory->rootEntriesLeft = volume->bootEntries->BPB_RootEntCnt;
+  }
+
+  return directory;
+}
+
+// Function to read the next cluster of a directory into its iterator, returns 0 at the end of the directory
+int loadDirectoryCluster(DirectoryIterator *directory)
+{
+  Volume *volume = directory->volume;
+  size_t bytesPerCluster = volume->bootEntries->BPB_BytsPerSec * volume->bootEntries->BPB_SecPerClus;
+  size_t numEntries = bytesPerCluster / sizeof(DirectoryEntry);
+  off_t offset;
+
+  if (directory->firstCluster == 0)
+  {
+    if (directory->rootEntriesLeft == 0)
+    {
+      return 0;
+    }
+    numEntries = numEntries < directory->rootEntriesLeft ? numEntries : directory->rootEntriesLeft;
+    offset = directory->rootOffset;
+    directory->rootOffset += numEntries * sizeof(DirectoryEntry);
+    directory->rootEntriesLeft -= numEntries;
+  }
+  else
+  {
+    // Stop at the end of the chain, and on chains longer than the FAT (a loop)
+    size_t cluster = directory->nextCluster;
+    if (cluster < 2 || cluster >= 0xfff8 || cluster >= volume->fatSize / sizeof(uint16_t) ||
+        directory->clustersRead >= volume->fatSize / sizeof(uint16_t))
+    {
+      return 0;
+    }
+    offset = volume->dataAreaStart + (off_t)(cluster - 2) * bytesPerCluster;
+    directory->nextCluster = volume->fatEntries[cluster];
+    directory->clustersRead++;
+  }
+
+  uint64_t traceStart = traceBegin();
+  ssize_t bytesRead = readSector(volume->openedFile, directory->entries, offset, numEntries * sizeof(DirectoryEntry));
+  traceEnd("loadDirectoryCluster", NULL, offset, traceStart);
+
+  directory->entryCount = bytesRead > 0 ? bytesRead / sizeof(DirectoryEntry) : 0;
+  directory->entryIndex = 0;
+  return directory->entryCount > 0;
+}
+
+// Function to decode the next entry of a directory, returns NULL at the end of the directory
+FullDirectoryEntry *readDirectory(DirectoryIterator *directory)
+{
+  while (!directory->finished)
+  {
+    if (directory->entryIndex == directory->entryCount && !loadDirectoryCluster(directory))
+    {
+      break;
+    }
+
+    DirectoryEntry entry = directory->entries[directory->entryIndex++];
+    uint8_t deleted = entry.DIR_Name[0] == 0xE5;
+
+    // Check if the entry is a valid file or directory
+    if (entry.DIR_Name[0] == 0x00)
+    {
+      break;
+    }
+    else if (deleted && !directory->includeDeleted)
+    {
+      continue;
+    }
+
+    // Long name parts never carry over between deleted and live entries
+    if (deleted != directory->namePartsDeleted)
+    {
+      directory->namePartsCount = 0;
+      directory->namePartsDeleted = deleted;
+    }
+
+    // Collect long name parts until the short entry they belong to, dropping runaway chains
+    if (isLongNameEntry(&entry))
+    {
+      if (directory->namePartsCount < MAX_NAME_PARTS)
+      {
+        decodeLongNamePart(&entry, directory->nameParts[directory->namePartsCount++]);
+      }
+      continue;
+    }
+
+    if (deleted)
+    {
+      entry.DIR_Name[0] = '_';
+    }
+    decodeDirectoryEntry(&entry, directory->nameParts, directory->namePartsCount, &directory->current);
+    directory->current.deleted = deleted;
+    directory->namePartsCount = 0;
+    return &directory->current;
+  }
+
+  directory->finished = 1;
+  return NULL;
+}
+
+// Function to check if the last entry returned was the last one of the cluster in memory
+int directoryClusterDone(const DirectoryIterator *directory)
+{
+  return directory->entryIndex == directory->entryCount;
+}
+
+// Function to close a directory iterator
+void closeDirectory(DirectoryIterator *directory)
+{
+  free(directory->entries);
+  free(directory);
+}
+
+// Open a file and return a File structure
+File *openFile(Volume *volume, FullDirectoryEntry *entry)
+{
+  File *file = malloc(sizeof(File));
+
+  file->openedFile = volume->openedFile;
+  file->bootEntries = volume->bootEntries;
+  file->fatEntries = volume->fatEntries;
+  file->fatSize = volume->fatSize;
+  file->dataAreaStart = volume->dataAreaStart;
+  file->currentClusterOffset = 0;
+  file->currentCluster = entry->DIR_FstClusLO;
+  file->clusterArray = NULL; // Initialize to NULL initially
+  file->clusterArraySize = 0;
+  file->fileSize = entry->DIR_FileSize;
+
+  // Populate the cluster array
+  size_t currentCluster = entry->DIR_FstClusLO;
+  while (currentCluster < 0xfff8)
+  {
+    file->clusterArray = realloc(file->clusterArray, (file->clusterArraySize + 1) * sizeof(size_t));
+
+    file->clusterArray[file->clusterArraySize] = currentCluster;
+    file->clusterArraySize++;
+
+    currentCluster = file->fatEntries[currentCluster];
+  }
+
+  return file;
+}
+
+// Seek to a specified offset within the file
+off_t seekFile(File *file, off_t offset, int whence)
+{
+  BootSector bootSector = *(file->bootEntries);
+
+  // Update current cluster offset based on the offset and whence
+  if (whence == SEEK_SET)
+  {
+    file->currentClusterOffset = offset;
+  }
+  else if (whence == SEEK_CUR)
+  {
+    file->currentClusterOffset += offset;
+  }
+  else if (whence == SEEK_END)
+  {
+    // Calculate the file size
+    size_t fileSize = file->fileSize;
+
+    // Update the current cluster offset based on the file size and offset
+    file->currentClusterOffset = fileSize - offset;
+  }
+
+  // Update the current cluster based on the offset
+  size_t clusterIndex = file->currentClusterOffset / (bootSector.BPB_BytsPerSec * bootSector.BPB_SecPerClus);
+
+  // Check if the clusterIndex is within the bounds of the clusterArray
+  if (clusterIndex < file->clusterArraySize)
+  {
+    file->currentCluster = file->clusterArray[clusterIndex];
+  }
+  else
+  {
+    // The seek operation is beyond the end of the file
+    file->currentCluster = 0xfff8; // Set it to an invalid value
+  }
+
+  return file->currentClusterOffset;
+}
+
+// Read data from the file into the buffer
+size_t readFile(File *file, void *buffer, size_t length)
+{
+  BootSector bootEntries = *(file->bootEntries);
+  size_t bytesPerCluster = bootEntries.BPB_BytsPerSec * bootEntries.BPB_SecPerClus;
+  size_t bytesRead = 0; // Total bytes read
+
+  // Never read past the end of the file
+  if (file->currentClusterOffset >= file->fileSize)
+  {
+    return 0;
+  }
+  if (length > (size_t)(file->fileSize - file->currentClusterOffset))
+  {
+    length = file->fileSize - file->currentClusterOffset;
+  }
+
+  while (bytesRead < length)
+  {
+    size_t clusterIndex = file->currentClusterOffset / bytesPerCluster;
+    if (clusterIndex >= file->clusterArraySize)
+    {
+      break;
+    }
+
+    // Calculate the offset within the current cluster
+    off_t clusterOffset = file->currentClusterOffset % bytesPerCluster;
+
+    // Extend the read over the following clusters for as long as they are consecutive on disk
+    size_t runEnd = clusterIndex + 1;
+    while (runEnd < file->clusterArraySize &&
+           (runEnd - clusterIndex) * bytesPerCluster < clusterOffset + (length - bytesRead) &&
+           file->clusterArray[runEnd] == file->clusterArray[runEnd - 1] + 1)
+    {
+      runEnd++;
+    }
+
+    // Calculate the offset within the data area
+    off_t dataOffset = file->dataAreaStart + (off_t)(file->clusterArray[clusterIndex] - 2) * bytesPerCluster + clusterOffset;
+
+    // Calculate the number of bytes available in the run and how many of them to read
+    size_t bytesAvailable = (runEnd - clusterIndex) * bytesPerCluster - clusterOffset;
+    size_t bytesToRead = (length - bytesRead) < bytesAvailable ? (length - bytesRead) : bytesAvailable;
+
+    // Read the whole run into the buffer at once
+    uint64_t traceStart = traceBegin();
+    ssize_t bytesReadFromRun = readSector(file->openedFile, (char *)buffer + bytesRead, dataOffset, bytesToRead);
+    traceEnd("readFile cluster run", NULL, file->clusterArray[clusterIndex], traceStart);
+    if (bytesReadFromRun <= 0)
+    {
+      break;
+    }
+
+    // Update the current cluster offset and total bytes read
+    file->currentClusterOffset += bytesReadFromRun;
+    bytesRead += bytesReadFromRun;
+  }
+
+  // Keep the current cluster in step with the offset
+  size_t clusterIndex = file->currentClusterOffset / bytesPerCluster;
+  file->currentCluster = clusterIndex < file->clusterArraySize ? file->clusterArray[clusterIndex] : 0xfff8;
+
+  return bytesRead;
+}
+
+// Close the file and free resources
+void closeFile(File *file)
+{
+  // Free the data
+  free(file->clusterArray);
+  free(file);
+}
+
+// Function to find a file/directory in a directory (cluster 0 is the root directory)
+FullDirectoryEntry *findDirectoryEntryInDirectory(Volume *volume, uint16_t directoryCluster, const char *name, FullDirectoryEntry *foundEntry)
+{
+  DirectoryIterator *directory = openDirectory(volume, directoryCluster, 0);
+  size_t nameLength = strlen(name);
+  FullDirectoryEntry *entry;
+
+  // Decode the directory one cluster at a time until the name turns up
+  while ((entry = readDirectory(directory)) != NULL)
+  {
+    // Check if the current entry matches the desired name based on either long name or short name
+    if ((strcmp(entry->DIR_Name, name) == 0) ||
+        (nameLength <= sizeof(entry->shortDIR_Name) && strncmp(entry->shortDIR_Name, name, nameLength) == 0))
+    {
+      // Return a copy of the found entry
+      *foundEntry = *entry;
+      closeDirectory(directory);
+      return foundEntry;
+    }
+  }
+
+  // If the entry is not found, return NULL
+  closeDirectory(directory);
+  return NULL;
+}
+
+// Function to find a directory entry based on the given path, one component at a time
+FullDirectoryEntry *findDirectoryEntryByPath(Volume *volume, const char *path, FullDirectoryEntry *foundEntry)
+{
+  // Split the path into individual components
+  char *pathCopy = strdup(path);
+  char *savePointer;
+  char *token = strtok_r(pathCopy, "/", &savePointer);
+
+  // Start looking in the root directory
+  uint16_t directoryCluster = 0;
+  FullDirectoryEntry *currentEntry = NULL;
+
+  while (token != NULL)
+  {
+    uint64_t traceStart = traceBegin();
+    currentEntry = findDirectoryEntryInDirectory(volume, directoryCluster, token, foundEntry);
+    traceEnd("findDirectoryEntryInDirectory", token, -1, traceStart);
+
+    // Stop if it does not exist, or if it is a file and so has no contents to search
+    if (currentEntry == NULL || !((currentEntry->DIR_Attr & 0x10) && !(currentEntry->DIR_Attr & 0x08)))
+    {
+      break;
+    }
+
+    // Get the next token and search the directory just found
+    token = strtok_r(NULL, "/", &savePointer);
+    directoryCluster = currentEntry->DIR_FstClusLO;
+  }
+
+  free(pathCopy);
+  return currentEntry;
+}
+
+// Maximum directory depth followed by a recursive walk, guards against directory loops
+#define MAX_WALK_DEPTH 64
+
+// Function to recursively output every entry below a directory (cluster 0 is the root directory)
+void walkDirectory(Volume *volume, uint16_t directoryCluster, const char *path, uint16_t depth)
+{
+  // Only one cluster per directory level is held in memory
+  DirectoryIterator *directory = openDirectory(volume, directoryCluster, 0);
+  FullDirectoryEntry *entry;
+
+  while ((entry = readDirectory(directory)) != NULL)
+  {
+    // Skip the volume label and the dot entries of sub directories
+    if ((entry->DIR_Attr & 0x08) || strcmp(entry->DIR_Name, ".") == 0 || strcmp(entry->DIR_Name, "..") == 0)
+    {
+      continue;
+    }
+
+    printFile(entry, path, directoryCluster, depth);
+
+    if ((entry->DIR_Attr & 0x10) && entry->DIR_FstClusLO >= 2 && depth < MAX_WALK_DEPTH)
+    {
+      size_t pathLength = strlen(path) + 1 + strlen(entry->DIR_Name) + 1;
+      char *childPath = malloc(pathLength);
+      if (childPath == NULL)
+      {
+        perror("Failed to allocate memory for path");
+        exit(EXIT_FAILURE);
+      }
+      snprintf(childPath, pathLength, "%s/%s", path, entry->DIR_Name);
+
+      walkDirectory(volume, entry->DIR_FstClusLO, childPath, depth + 1);
+      free(childPath);
+    }
+  }
+
+  closeDirectory(directory);
+}
+
+// Function to print the decoded values of a found entry and its content
+void processEntry(Volume *volume, FullDirectoryEntry *newEntry, const char *newFilePath)
+{
+  if (newEntry != NULL)
+  {
+    // Build absolute paths of the entry and its parent for the machine readable formats
+    while (*newFilePath == '/')
+    {
+      newFilePath++;
+    }
+    size_t pathLength = strlen(newFilePath) + 2;
+    char *entryPath = malloc(pathLength);
+    char *parentPath = malloc(pathLength);
+    if (entryPath == NULL || parentPath == NULL)
+    {
+      perror("Failed to allocate memory for path");
+      exit(EXIT_FAILURE);
+    }
+    snprintf(entryPath, pathLength, "/%s", newFilePath);
+    while (pathLength > 3 && entryPath[pathLength - 2] == '/')
+    {
+      entryPath[--pathLength - 1] = '\0';
+    }
+    strcpy(parentPath, entryPath);
+    *strrchr(parentPath, '/') = '\0';
+
+    printf("\nEntry found for path: %s\n\n", newFilePath);
+    printListingHeader();
+    printFile(newEntry, parentPath, 0, 0);
+    outputFlush(&standardOutput);
+
+    printf("\n==================================================");
+    printf("====================================================");
+    printf("\nCONTENTS OF %s\n", newEntry->DIR_Name);
+
+    // If its a directory prints its sub content (files or directories)
+    if ((newEntry->DIR_Attr & 0x10) && !(newEntry->DIR_Attr & 0x08))
+    {
+      // Entries are shown as each cluster is decoded, so huge directories start listing at once
+      DirectoryIterator *directory = openDirectory(volume, newEntry->DIR_FstClusLO, 0);
+      FullDirectoryEntry *entry;
+      while ((entry = readDirectory(directory)) != NULL)
+      {
+        printFile(entry, entryPath, newEntry->DIR_FstClusLO, 0);
+        if (directoryClusterDone(directory))
+        {
+          outputFlush(&standardOutput);
+        }
+      }
+      closeDirectory(directory);
+      outputFlush(&standardOutput);
+    }
+    else // Else print the files output
+    {
+      File *file = openFile(volume, newEntry);
+
+      // Seek to the beginning of the file
+      seekFile(file, 0, SEEK_SET);
+
+      // Ask the user for the buffer size
+      size_t bufferSize;
+      printf("Enter the buffer size: ");
+      scanf("%zu", &bufferSize);
+
+      // Read and print the content of the file
+      char *buffer = (char *)malloc(bufferSize);
+      if (buffer == NULL)
+      {
+        perror("Error allocating memory for buffer");
+        exit(EXIT_FAILURE);
+      }
+
+      size_t bytesRead = readFile(file, buffer, bufferSize);
+
+      // Print the data read from the file
+      for (size_t i = 0; i < bytesRead; ++i)
+      {
+        printf("%c", buffer[i]);
+      }
+      printf("\n");
+
+      // Free allocated memory
+      free(buffer);
+    }
+
+    free(entryPath);
+    free(parentPath);
+  }
+  else
+  {
+    printf("Entry not found for path: %s\n", newFilePath);
+  }
+}
+
+// Largest number of clusters a FAT16 volume can address, and the smallest it may have
+#define FAT16_MAX_CLUSTERS 65524
+#define FAT16_MIN_CLUSTERS 4085
+
+// Largest number of entries a sub directory may hold (2 MiB of entries)
+#define FAT16_MAX_DIRECTORY_ENTRIES 65536
+
+// Sector size of packed images
+#define PACK_SECTOR_SIZE 512
+
+// Function to compare pack nodes by name for a stable directory order
+int comparePackNodes(const void *a, const void *b)
+{
+  return strcmp(((const PackNode *)a)->name, ((const PackNode *)b)->name);
+}
+
+// Function to collect a host file or directory, and everything below it, into a pack node
+void collectPackNode(PackNode *node, const char *hostPath, const char *name, const struct stat *status)
+{
+  memset(node, 0, sizeof(PackNode));
+  node->hostPath = strdup(hostPath);
+  node->name = strdup(name);
+  node->isDirectory = S_ISDIR(status->st_mode);
+  node->modifiedTime = status->st_mtime;
+
+  if (!node->isDirectory)
+  {
+    if (status->st_size > UINT32_MAX)
+    {
+      fprintf(stderr, "%s: file is too large for FAT16\n", hostPath);
+      exit(EXIT_FAILURE);
+    }
+    node->fileSize = status->st_size;
+    return;
+  }
+
+  DIR *directory = opendir(hostPath);
+  if (directory == NULL)
+  {
+    perror(hostPath);
+    exit(EXIT_FAILURE);
+  }
+
+  size_t childCapacity = 0;
+  struct dirent *hostEntry;
+  while ((hostEntry = readdir(directory)) != NULL)
+  {
+    if (strcmp(hostEntry->d_name, ".") == 0 || strcmp(hostEntry->d_name, "..") == 0)
+    {
+      continue;
+    }
+
+    size_t pathLength = strlen(hostPath) + 1 + strlen(hostEntry->d_name) + 1;
+    char *childPath = malloc(pathLength);
+    if (childPath == NULL)
+    {
+      perror("Failed to allocate memory for path");
+      exit(EXIT_FAILURE);
+    }
+    snprintf(childPath, pathLength, "%s/%s", hostPath, hostEntry->d_name);
+
+    // Only regular files and directories can be stored, links are not followed so they cannot loop
+    struct stat childStatus;
+    const char *skipReason = NULL;
+    if (lstat(childPath, &childStatus) == -1)
+    {
+      skipReason = strerror(errno);
+    }
+    else if (S_ISLNK(childStatus.st_mode))
+    {
+      skipReason = "symbolic link";
+    }
+    else if (!(S_ISREG(childStatus.st_mode) || S_ISDIR(childStatus.st_mode)))
+    {
+      skipReason = "not a regular file or directory";
+    }
+    if (skipReason != NULL)
+    {
+      fprintf(stderr, "Skipping %s: %s\n", childPath, skipReason);
+      free(childPath);
+      continue;
+    }
+    if (strlen(hostEntry->d_name) > 255)
+    {
+      fprintf(stderr, "Skipping %s: name is too long\n", childPath);
+      free(childPath);
+      continue;
+    }
+
+    if (node->childCount >= childCapacity)
+    {
+      childCapacity = childCapacity == 0 ? 16 : childCapacity * 2;
+      node->children = realloc(node->children, childCapacity * sizeof(PackNode));
+      if (node->children == NULL)
+      {
+        perror("Failed to allocate memory for directory contents");
+        exit(EXIT_FAILURE);
+      }
+    }
+
+    collectPackNode(&node->children[node->childCount], childPath, hostEntry->d_name, &childStatus);
+    node->childCount++;
+    free(childPath);
+  }
+  closedir(directory);
+
+  qsort(node->children, node->childCount, sizeof(PackNode), comparePackNodes);
+}
+
+// Function to free a pack node and everything below it
+void freePackNode(PackNode *node)
+{
+  for (size_t i = 0; i < node->childCount; i++)
+  {
+    freePackNode(&node->children[i]);
+  }
+  free(node->children);
+  free(node->hostPath);
+  free(node->name);
+}
+
+// Function to check if a character may be stored in a short name
+int isShortNameChar(unsigned char c)
+{
+  return isupper(c) || isdigit(c) || (c != 0 && strchr("$%'-_@~`!(){}^#&", c) != NULL);
+}
+
+// Function to decode one UTF-8 character of a host name into a UCS-2 code unit
+uint16_t decodeUtf8(const char **text)
+{
+  const unsigned char *c = (const unsigned char *)*text;
+
+  if (c[0] < 0x80)
+  {
+    *text += 1;
+    return c[0];
+  }
+  if ((c[0] & 0xE0) == 0xC0 && (c[1] & 0xC0) == 0x80)
+  {
+    *text += 2;
+    return ((c[0] & 0x1F) << 6) | (c[1] & 0x3F);
+  }
+  if ((c[0] & 0xF0) == 0xE0 && (c[1] & 0xC0) == 0x80 && (c[2] & 0xC0) == 0x80)
+  {
+    *text += 3;
+    return ((c[0] & 0x0F) << 12) | ((c[1] & 0x3F) << 6) | (c[2] & 0x3F);
+  }
+
+  // Characters outside the basic multilingual plane and invalid bytes are replaced
+  *text += 1;
+  while ((**text & 0xC0) == 0x80)
+  {
+    *text += 1;
+  }
+  return '_';
+}
+
+// Function to map one character of a long name to a short name character
+uint8_t toShortNameChar(uint16_t character, int *lossy, int *caseChanged)
+{
+  if (character >= 0x80)
+  {
+    *lossy = 1;
+    return '_';
+  }
+
+  uint8_t upper = toupper(character);
+  if (upper != character)
+  {
+    *caseChanged = 1;
+  }
+  if (!isShortNameChar(upper))
+  {
+    *lossy = 1;
+    return '_';
+  }
+  return upper;
+}
+
+// Function to build the space padded 8.3 basis of a long name, returns whether characters were lost
+int buildShortNameBasis(const char *name, uint8_t *basis, int *caseChanged)
+{
+  const char *extension = strrchr(name, '.');
+  if (extension == name)
+  {
+    extension = NULL;
+  }
+
+  size_t basisLength = 0, extensionLength = 0;
+  int lossy = 0;
+  *caseChanged = 0;
+  memset(basis, ' ', 11);
+
+  // Characters are substituted once each, however many UTF-8 bytes they take
+  const char *c = name;
+  while (*c != '\0' && c != extension)
+  {
+    uint16_t character = decodeUtf8(&c);
+    if (character == ' ' || character == '.')
+    {
+      lossy = 1;
+      continue;
+    }
+    uint8_t shortChar = toShortNameChar(character, &lossy, caseChanged);
+    if (basisLength < 8)
+    {
+      basis[basisLength++] = shortChar;
+    }
+    else
+    {
+      lossy = 1;
+    }
+  }
+  c = extension != NULL ? extension + 1 : "";
+  while (*c != '\0')
+  {
+    uint8_t shortChar = toShortNameChar(decodeUtf8(&c), &lossy, caseChanged);
+    if (extensionLength < 3)
+    {
+      basis[8 + extensionLength++] = shortChar;
+    }
+    else
+    {
+      lossy = 1;
+    }
+  }
+
+  if (basisLength == 0 || (extension != NULL && extensionLength == 0))
+  {
+    lossy = 1;
+  }
+  if (basisLength == 0)
+  {
+    basis[0] = '_';
+  }
+  return lossy;
+}
+
+// Function to hash an 11 byte short name (FNV-1a)
+size_t hashShortName(const uint8_t *name)
+{
+  uint32_t hash = 2166136261u;
+  for (int i = 0; i < 11; i++)
+  {
+    hash = (hash ^ name[i]) * 16777619u;
+  }
+  return hash;
+}
+
+// Function to add a name to the used names of a directory, returns 0 if it is already used
+int insertShortName(ShortNameTable *table, const uint8_t *name)
+{
+  size_t slot = hashShortName(name) & table->mask;
+  while (table->names[slot][0] != 0)
+  {
+    if (memcmp(table->names[slot], name, 11) == 0)
+    {
+      return 0;
+    }
+    slot = (slot + 1) & table->mask;
+  }
+  memcpy(table->names[slot], name, 11);
+  return 1;
+}
+
+// Function to find the next numeric tail to try for a basis, starting at 1 for a new basis
+unsigned *findBasisTail(ShortNameTable *table, const uint8_t *basis)
+{
+  size_t slot = hashShortName(basis) & table->mask;
+  while (table->bases[slot][0] != 0 && memcmp(table->bases[slot], basis, 11) != 0)
+  {
+    slot = (slot + 1) & table->mask;
+  }
+  if (table->bases[slot][0] == 0)
+  {
+    memcpy(table->bases[slot], basis, 11);
+    table->nextTails[slot] = 1;
+  }
+  return &table->nextTails[slot];
+}
+
+// Function to generate a unique 8.3 name for every child of a directory
+void generateShortNames(PackNode *directory)
+{
+  // Slots are kept at most half full so a lookup takes about one probe
+  ShortNameTable table;
+  size_t slotCount = 16;
+  while (slotCount < 2 * directory->childCount)
+  {
+    slotCount <<= 1;
+  }
+  table.names = calloc(slotCount, sizeof(*table.names));
+  table.bases = calloc(slotCount, sizeof(*table.bases));
+  table.nextTails = calloc(slotCount, sizeof(*table.nextTails));
+  table.mask = slotCount - 1;
+  uint8_t *needsTail = calloc(directory->childCount + 1, 1);
+  if (table.names == NULL || table.bases == NULL || table.nextTails == NULL || needsTail == NULL)
+  {
+    perror("Failed to allocate memory for short names");
+    exit(EXIT_FAILURE);
+  }
+
+  // Names that already are valid 8.3 names are stored as they are, first so generated names never take them
+  for (size_t i = 0; i < directory->childCount; i++)
+  {
+    PackNode *node = &directory->children[i];
+    int caseChanged;
+    int lossy = buildShortNameBasis(node->name, node->shortName, &caseChanged);
+    node->needsLongName = lossy || caseChanged;
+    needsTail[i] = lossy || !insertShortName(&table, node->shortName);
+  }
+
+  // Everything else gets the basis with the next free numeric tail
+  for (size_t i = 0; i < directory->childCount; i++)
+  {
+    if (!needsTail[i])
+    {
+      continue;
+    }
+
+    PackNode *node = &directory->children[i];
+    uint8_t basis[11];
+    memcpy(basis, node->shortName, sizeof(basis));
+    size_t basisLength = 0;
+    while (basisLength < 8 && basis[basisLength] != ' ')
+    {
+      basisLength++;
+    }
+
+    unsigned *tail = findBasisTail(&table, basis);
+    do
+    {
+      char tailText[10];
+      int tailLength = snprintf(tailText, sizeof(tailText), "~%u", (*tail)++);
+      size_t keep = basisLength < (size_t)(8 - tailLength) ? basisLength : (size_t)(8 - tailLength);
+      memset(node->shortName + keep, ' ', 8 - keep);
+      memcpy(node->shortName + keep, tailText, tailLength);
+    } while (!insertShortName(&table, node->shortName));
+    node->needsLongName = 1;
+  }
+
+  free(table.names);
+  free(table.bases);
+  free(table.nextTails);
+  free(needsTail);
+
+  for (size_t i = 0; i < directory->childCount; i++)
+  {
+    if (directory->children[i].isDirectory)
+    {
+      generateShortNames(&directory->children[i]);
+    }
+  }
+}
+
+// Function to calculate the number of LFN entries needed for a name
+size_t countLongNameEntries(const PackNode *node)
+{
+  if (!node->needsLongName)
+  {
+    return 0;
+  }
+
+  size_t length = 0;
+  for (const char *c = node->name; *c != '\0'; length++)
+  {
+    decodeUtf8(&c);
+  }
+
+  // The terminating zero only takes space when the name is not a multiple of 13 characters
+  return (length + 12) / 13;
+}
+
+// Function to calculate the number of directory entries a directory needs
+size_t countDirectoryEntries(const PackNode *directory, int isRoot)
+{
+  size_t count = isRoot ? 0 : 2;
+  for (size_t i = 0; i < directory->childCount; i++)
+  {
+    count += 1 + countLongNameEntries(&directory->children[i]);
+  }
+  return count;
+}
+
+// Function to check that no sub directory holds more entries than FAT allows
+void checkDirectorySizes(const PackNode *directory)
+{
+  for (size_t i = 0; i < directory->childCount; i++)
+  {
+    const PackNode *node = &directory->children[i];
+    if (!node->isDirectory)
+    {
+      continue;
+    }
+    if (countDirectoryEntries(node, 0) > FAT16_MAX_DIRECTORY_ENTRIES)
+    {
+      fprintf(stderr, "%s: too many entries for a directory (at most %d, long names included)\n", node->hostPath, FAT16_MAX_DIRECTORY_ENTRIES);
+      exit(EXIT_FAILURE);
+    }
+    checkDirectorySizes(node);
+  }
+}
+
+// Function to count the clusters a sub tree needs with a given cluster size
+size_t countPackClusters(const PackNode *node, size_t bytesPerCluster, int isRoot)
+{
+  size_t clusters = 0;
+
+  if (!node->isDirectory)
+  {
+    return (node->fileSize + bytesPerCluster - 1) / bytesPerCluster;
+  }
+  if (!isRoot)
+  {
+    clusters = (countDirectoryEntries(node, 0) * sizeof(DirectoryEntry) + bytesPerCluster - 1) / bytesPerCluster;
+  }
+  for (size_t i = 0; i < node->childCount; i++)
+  {
+    clusters += countPackClusters(&node->children[i], bytesPerCluster, 0);
+  }
+  return clusters;
+}
+
+// Function to give every file and directory one contiguous extent, in the order they are written
+void allocatePackClusters(PackNode *node, size_t bytesPerCluster, uint16_t *fatEntries, size_t *nextCluster, int isRoot)
+{
+  if (!isRoot)
+  {
+    size_t bytes = node->isDirectory ? countDirectoryEntries(node, 0) * sizeof(DirectoryEntry) : node->fileSize;
+    node->clusterCount = (bytes + bytesPerCluster - 1) / bytesPerCluster;
+    node->firstCluster = node->clusterCount > 0 ? *nextCluster : 0;
+
+    // Chain the extent in the FAT
+    for (size_t i = 0; i < node->clusterCount; i++)
+    {
+      fatEntries[*nextCluster + i] = i + 1 < node->clusterCount ? *nextCluster + i + 1 : 0xFFFF;
+    }
+    *nextCluster += node->clusterCount;
+  }
+
+  if (node->isDirectory)
+  {
+    for (size_t i = 0; i < node->childCount; i++)
+    {
+      allocatePackClusters(&node->children[i], bytesPerCluster, fatEntries, nextCluster, 0);
+    }
+  }
+}
+
+// Function to calculate the checksum of a short name stored in LFN entries
+uint8_t calculateShortNameChecksum(const uint8_t *shortName)
+{
+  uint8_t sum = 0;
+  for (int i = 0; i < 11; i++)
+  {
+    sum = ((sum & 1) << 7) + (sum >> 1) + shortName[i];
+  }
+  return sum;
+}
+
+// Function to encode a host time as a FAT date and time
+void encodeDateTime(time_t hostTime, uint16_t *packedDate, uint16_t *packedTime)
+{
+  struct tm local;
+  localtime_r(&hostTime, &local);
+
+  // Clamp to the range a FAT date can hold, 1980-01-01 to 2107-12-31 23:59:58
+  if (local.tm_year < 80)
+  {
+    *packedDate = (1 << 5) | 1;
+    *packedTime = 0;
+    return;
+  }
+  if (local.tm_year - 80 > 127)
+  {
+    *packedDate = (127 << 9) | (12 << 5) | 31;
+    *packedTime = (23 << 11) | (59 << 5) | 29;
+    return;
+  }
+
+  *packedDate = ((local.tm_year - 80) << 9) | ((local.tm_mon + 1) << 5) | local.tm_mday;
+  *packedTime = (local.tm_hour << 11) | (local.tm_min << 5) | (local.tm_sec / 2);
+}
+
+// Function to fill a short directory entry
+void fillShortEntry(DirectoryEntry *entry, const uint8_t *shortName, uint8_t attributes, uint16_t firstCluster, uint32_t fileSize, time_t modifiedTime)
+{
+  memset(entry, 0, sizeof(DirectoryEntry));
+  memcpy(entry->DIR_Name, shortName, sizeof(entry->DIR_Name));
+  entry->DIR_Attr = attributes;
+  entry->DIR_FstClusLO = firstCluster;
+  entry->DIR_FileSize = fileSize;
+
+  uint16_t packedDate, packedTime;
+  encodeDateTime(modifiedTime, &packedDate, &packedTime);
+  entry->DIR_CrtTime = packedTime;
+  entry->DIR_CrtDate = packedDate;
+  entry->DIR_LstAccDate = packedDate;
+  entry->DIR_WrtTime = packedTime;
+  entry->DIR_WrtDate = packedDate;
+}
+
+// Function to build the directory entries of a directory, returns the number written
+size_t buildDirectoryEntries(const PackNode *directory, uint16_t parentCluster, int isRoot, DirectoryEntry *entries)
+{
+  size_t count = 0;
+
+  if (!isRoot)
+  {
+    fillShortEntry(&entries[count++], (const uint8_t *)".          ", 0x10, directory->firstCluster, 0, directory->modifiedTime);
+    fillShortEntry(&entries[count++], (const uint8_t *)"..         ", 0x10, parentCluster, 0, directory->modifiedTime);
+  }
+
+  for (size_t i = 0; i < directory->childCount; i++)
+  {
+    const PackNode *node = &directory->children[i];
+    size_t longEntries = countLongNameEntries(node);
+
+    if (longEntries > 0)
+    {
+      // Spread the name over 13 character slots, zero terminated and padded with 0xFFFF
+      uint16_t characters[MAX_NAME_PARTS * 13];
+      size_t length = 0;
+      for (const char *c = node->name; *c != '\0';)
+      {
+        characters[length++] = decodeUtf8(&c);
+      }
+      for (size_t j = length; j < longEntries * 13; j++)
+      {
+        characters[j] = j == length ? 0x0000 : 0xFFFF;
+      }
+
+      // LFN entries are stored last part first
+      uint8_t checksum = calculateShortNameChecksum(node->shortName);
+      for (size_t part = longEntries; part > 0; part--)
+      {
+        EntryUnion entryUnion;
+        LongDirectoryEntry *longEntry = &entryUnion.longDirEntry;
+        const uint16_t *slot = &characters[(part - 1) * 13];
+
+        memset(longEntry, 0, sizeof(LongDirectoryEntry));
+        longEntry->LDIR_Ord = part | (part == longEntries ? 0x40 : 0);
+        longEntry->LDIR_Attr = 0x0F;
+        longEntry->LDIR_Chksum = checksum;
+        memcpy(longEntry->LDIR_Name1, slot, sizeof(longEntry->LDIR_Name1));
+        memcpy(longEntry->LDIR_Name2, slot + 5, sizeof(longEntry->LDIR_Name2));
+        memcpy(longEntry->LDIR_Name3, slot + 11, sizeof(longEntry->LDIR_Name3));
+        entries[count++] = entryUnion.dirEntry;
+      }
+    }
+
+    fillShortEntry(&entries[count++], node->shortName, node->isDirectory ? 0x10 : 0x20,
+                   node->firstCluster, node->isDirectory ? 0 : node->fileSize, node->modifiedTime);
+  }
+
+  return count;
+}
+
+// Function to write the data area of a sub tree, in allocation order
+void writePackData(OutputBuffer *image, const PackNode *node, uint16_t parentCluster, size_t bytesPerCluster)
+{
+  size_t extentBytes = node->clusterCount * bytesPerCluster;
+
+  if (node->isDirectory)
+  {
+    if (extentBytes > 0)
+    {
+      char *clusters = outputReserve(image, extentBytes);
+      memset(clusters, 0, extentBytes);
+      buildDirectoryEntries(node, parentCluster, 0, (DirectoryEntry *)clusters);
+      image->used += extentBytes;
+    }
+
+    for (size_t i = 0; i < node->childCount; i++)
+    {
+      writePackData(image, &node->children[i], node->firstCluster, bytesPerCluster);
+    }
+    return;
+  }
+  if (node->fileSize == 0)
+  {
+    return;
+  }
+
+  int hostFile = open(node->hostPath, O_RDONLY);
+  if (hostFile == -1)
+  {
+    perror(node->hostPath);
+    exit(EXIT_FAILURE);
+  }
+
+  // Read the file straight into the output buffer in large blocks
+  size_t remaining = node->fileSize;
+  while (remaining > 0)
+  {
+    size_t blockSize = remaining < OUTPUT_BUFFER_SIZE ? remaining : OUTPUT_BUFFER_SIZE;
+    char *block = outputReserve(image, blockSize);
+    ssize_t bytesRead = read(hostFile, block, blockSize);
+    if (bytesRead <= 0)
+    {
+      fprintf(stderr, "%s: file changed while packing\n", node->hostPath);
+      exit(EXIT_FAILURE);
+    }
+    image->used += bytesRead;
+    remaining -= bytesRead;
+  }
+  close(hostFile);
+
+  // Pad the last cluster of the extent
+  size_t padding = extentBytes - node->fileSize;
+  memset(outputReserve(image, padding), 0, padding);
+  image->used += padding;
+}
+
+// Function to pack a host directory into a new FAT16 image
+int packImage(const char *hostDirectory, const char *imagePath)
+{
+  struct stat status;
+  if (stat(hostDirectory, &status) == -1)
+  {
+    perror(hostDirectory);
+    exit(EXIT_FAILURE);
+  }
+  if (!S_ISDIR(status.st_mode))
+  {
+    fprintf(stderr, "%s: not a directory\n", hostDirectory);
+    exit(EXIT_FAILURE);
+  }
+
+  PackNode root;
+  collectPackNode(&root, hostDirectory, "", &status);
+  generateShortNames(&root);
+  checkDirectorySizes(&root);
+
+  // The root directory region is a multiple of 16 entries and at least the usual 512
+  size_t rootEntries = (countDirectoryEntries(&root, 1) + 15) / 16 * 16;
+  if (rootEntries < 512)
+  {
+    rootEntries = 512;
+  }
+  if (rootEntries > 0xFFF0)
+  {
+    fprintf(stderr, "%s: too many entries for the root directory\n", hostDirectory);
+    exit(EXIT_FAILURE);
+  }
+
+  // Pick the smallest cluster size that can hold everything
+  size_t sectorsPerCluster = 1, clusterCount = 0;
+  for (; sectorsPerCluster <= 64; sectorsPerCluster *= 2)
+  {
+    clusterCount = countPackClusters(&root, sectorsPerCluster * PACK_SECTOR_SIZE, 1);
+    if (clusterCount <= FAT16_MAX_CLUSTERS)
+    {
+      break;
+    }
+  }
+  if (sectorsPerCluster > 64)
+  {
+    fprintf(stderr, "%s: contents do not fit in a FAT16 volume\n", hostDirectory);
+    exit(EXIT_FAILURE);
+  }
+  size_t usedClusters = clusterCount;
+  if (clusterCount < FAT16_MIN_CLUSTERS)
+  {
+    clusterCount = FAT16_MIN_CLUSTERS;
+  }
+
+  // Compute the geometry
+  size_t bytesPerCluster = sectorsPerCluster * PACK_SECTOR_SIZE;
+  size_t fatSectors = ((clusterCount + 2) * sizeof(uint16_t) + PACK_SECTOR_SIZE - 1) / PACK_SECTOR_SIZE;
+  size_t rootSectors = rootEntries * sizeof(DirectoryEntry) / PACK_SECTOR_SIZE;
+  size_t totalSectors = 1 + 2 * fatSectors + rootSectors + clusterCount * sectorsPerCluster;
+
+  BootSector bootSector;
+  memset(&bootSector, 0, sizeof(BootSector));
+  memcpy(bootSector.BS_jmpBoot, "\xEB\x3C\x90", 3);
+  memcpy(bootSector.BS_OEMName, "MSWIN4.1", 8);
+  bootSector.BPB_BytsPerSec = PACK_SECTOR_SIZE;
+  bootSector.BPB_SecPerClus = sectorsPerCluster;
+  bootSector.BPB_RsvdSecCnt = 1;
+  bootSector.BPB_NumFATs = 2;
+  bootSector.BPB_RootEntCnt = rootEntries;
+  bootSector.BPB_TotSec16 = totalSectors < 0x10000 ? totalSectors : 0;
+  bootSector.BPB_Media = 0xF8;
+  bootSector.BPB_FATSz16 = fatSectors;
+  bootSector.BPB_SecPerTrk = 63;
+  bootSector.BPB_NumHeads = 255;
+  bootSector.BPB_TotSec32 = totalSectors < 0x10000 ? 0 : totalSectors;
+  bootSector.BS_DrvNum = 0x80;
+  bootSector.BS_BootSig = 0x29;
+  bootSector.BS_VolID = (uint32_t)time(NULL);
+  memcpy(bootSector.BS_VolLab, "NO NAME    ", 11);
+  memcpy(bootSector.BS_FilSysType, "FAT16   ", 8);
+
+  // Lay out the FAT, every extent is one run of consecutive clusters
+  size_t fatSize = fatSectors * PACK_SECTOR_SIZE;
+  uint16_t *fatEntries = calloc(1, fatSize);
+  if (fatEntries == NULL)
+  {
+    perror("Failed to allocate memory for FAT");
+    exit(EXIT_FAILURE);
+  }
+  fatEntries[0] = 0xFF00 | bootSector.BPB_Media;
+  fatEntries[1] = 0xFFFF;
+  size_t nextCluster = 2;
+  allocatePackClusters(&root, bytesPerCluster, fatEntries, &nextCluster, 1);
+
+  int imageFile = open(imagePath, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (imageFile == -1)
+  {
+    perror("Error creating image");
+    exit(EXIT_FAILURE);
+  }
+  OutputBuffer image = {imageFile, NULL, 0, 0};
+
+  // Boot sector
+  char *sector = outputReserve(&image, PACK_SECTOR_SIZE);
+  memset(sector, 0, PACK_SECTOR_SIZE);
+  memcpy(sector, &bootSector, sizeof(BootSector));
+  sector[510] = 0x55;
+  sector[511] = (char)0xAA;
+  image.used += PACK_SECTOR_SIZE;
+
+  // FAT copies
+  for (int i = 0; i < bootSector.BPB_NumFATs; i++)
+  {
+    outputWrite(&image, fatEntries, fatSize);
+  }
+
+  // Root directory region
+  size_t rootBytes = rootSectors * PACK_SECTOR_SIZE;
+  char *rootRegion = outputReserve(&image, rootBytes);
+  memset(rootRegion, 0, rootBytes);
+  buildDirectoryEntries(&root, 0, 1, (DirectoryEntry *)rootRegion);
+  image.used += rootBytes;
+
+  // Data area, written sequentially in allocation order
+  writePackData(&image, &root, 0, bytesPerCluster);
+  outputFlush(&image);
+
+  // Unused clusters at the end are left as a hole
+  if (ftruncate(imageFile, (off_t)totalSectors * PACK_SECTOR_SIZE) == -1 || close(imageFile) == -1)
+  {
+    perror("Error writing image");
+    exit(EXIT_FAILURE);
+  }
+
+  printf("Packed %zu clusters of %zu bytes into %s (%zu sectors)\n", usedClusters, bytesPerCluster, imagePath, totalSectors);
+
+  free(image.data);
+  free(fatEntries);
+  freePackNode(&root);
+  return 0;
+}
+
+// Size of each sequential read of the data area while carving
+#define CARVE_READ_SIZE (8 << 20)
+
+// Signatures of common file types, matched at the start of free clusters
+const FileSignature fileSignatures[] = {
+    {"jpg", "\xFF\xD8\xFF", 3, NULL},
+    {"png", "\x89PNG\r\n\x1A\n", 8, NULL},
+    {"gif", "GIF8", 4, NULL},
+    {"pdf", "%PDF-", 5, NULL},
+    {"zip", "PK\x03\x04", 4, NULL},
+    {"gz", "\x1F\x8B\x08", 3, NULL},
+    {"elf", "\x7F" "ELF", 4, NULL},
+    {"wav", "RIFF", 4, "WAVE"},
+    {"avi", "RIFF", 4, "AVI "},
+    {"webp", "RIFF", 4, "WEBP"},
+    {"riff", "RIFF", 4, NULL}, // Any other RIFF container, after the known form types
+};
+#define NUM_FILE_SIGNATURES (sizeof(fileSignatures) / sizeof(fileSignatures[0]))
+
+// Whether recover also carves free clusters for known file signatures
+int carveFreeSpace = 0;
+
+// Function to calculate the number of data clusters in a volume
+size_t countDataClusters(Volume *volume)
+{
+  BootSector *bootSector = volume->bootEntries;
+  size_t totalSectors = bootSector->BPB_TotSec16 != 0 ? bootSector->BPB_TotSec16 : bootSector->BPB_TotSec32;
+  size_t dataSectors = totalSectors - volume->dataAreaStart / bootSector->BPB_BytsPerSec;
+  size_t clusterCount = dataSectors / bootSector->BPB_SecPerClus;
+
+  // Never look past the end of the FAT
+  size_t fatClusters = volume->fatSize / sizeof(uint16_t) - 2;
+  return clusterCount < fatClusters ? clusterCount : fatClusters;
+}
+
+// Function to check if a cluster is free and not yet attributed to a recovered file
+int isRecoverableCluster(Volume *volume, RecoveryState *state, size_t cluster)
+{
+  return cluster >= 2 && cluster < state->clusterCount + 2 && volume->fatEntries[cluster] == 0 && !state->claimedClusters[cluster];
+}
+
+// Function to guess the cluster runs of a deleted file, returns the number of runs found
+size_t reconstructClusterRuns(Volume *volume, RecoveryState *state, size_t firstCluster, uint32_t fileSize, ClusterRun **runs)
+{
+  size_t bytesPerCluster = volume->bootEntries->BPB_BytsPerSec * volume->bootEntries->BPB_SecPerClus;
+  size_t clustersNeeded = (fileSize + bytesPerCluster - 1) / bytesPerCluster;
+  size_t runCount = 0, runCapacity = 0;
+  *runs = NULL;
+
+  // The FAT chain is gone, so take the free clusters following the first one, skipping allocated ones
+  if (!isRecoverableCluster(volume, state, firstCluster))
+  {
+    return 0;
+  }
+  for (size_t cluster = firstCluster; clustersNeeded > 0 && cluster < state->clusterCount + 2; cluster++)
+  {
+    if (!isRecoverableCluster(volume, state, cluster))
+    {
+      continue;
+    }
+
+    if (runCount > 0 && (*runs)[runCount - 1].firstCluster + (*runs)[runCount - 1].clusterCount == cluster)
+    {
+      (*runs)[runCount - 1].clusterCount++;
+    }
+    else
+    {
+      if (runCount >= runCapacity)
+      {
+        runCapacity = runCapacity == 0 ? 4 : runCapacity * 2;
+        *runs = realloc(*runs, runCapacity * sizeof(ClusterRun));
+        if (*runs == NULL)
+        {
+          perror("Failed to allocate memory for cluster runs");
+          exit(EXIT_FAILURE);
+        }
+      }
+      (*runs)[runCount].firstCluster = cluster;
+      (*runs)[runCount].clusterCount = 1;
+      runCount++;
+    }
+    clustersNeeded--;
+  }
 
-  // Populate the cluster array
-  size_t currentCluster = entry->DIR_FstClusLO;
-  while (currentCluster < 0xfff8)
+  // Claim the clusters so carving and later entries do not report them again
+  for (size_t i = 0; i < runCount; i++)
   {
-    file->clusterArray = realloc(file->clusterArray, (file->clusterArraySize + 1) * sizeof(size_t));
-
-    file->clusterArray[file->clusterArraySize] = currentCluster;
-    file->clusterArraySize++;
-
-    currentCluster = file->fatEntries[currentCluster];
+    memset(&state->claimedClusters[(*runs)[i].firstCluster], 1, (*runs)[i].clusterCount);
   }
 
-  return file;
+  return runCount;
 }
 
-// Seek to a specified offset within the file
-off_t seekFile(File *file, off_t offset, int whence)
+// Function to write a recovered file or carved region to the output
+void outputRecovery(OutputBuffer *output, const char *kind, const char *status, const char *parentPath, const char *name, uint32_t fileSize, const ClusterRun *runs, size_t runCount)
 {
-  BootSector bootSector = *(file->bootEntries);
+  size_t pathLength = strlen(parentPath) + 1 + strlen(name);
+  char *start = outputReserve(output, 256 + 6 * pathLength + 24 * runCount);
+  char *out = start;
 
-  // Update current cluster offset based on the offset and whence
-  if (whence == SEEK_SET)
-  {
-    file->currentClusterOffset = offset;
-  }
-  else if (whence == SEEK_CUR)
+  if (outputFormat == FORMAT_JSONL)
   {
-    file->currentClusterOffset += offset;
+    out = formatLiteral(out, "{\"kind\":\"");
+    out = formatLiteral(out, kind);
+    out = formatLiteral(out, "\",\"status\":\"");
+    out = formatLiteral(out, status);
+    out = formatLiteral(out, "\",\"path\":\"");
+    out = formatJsonText(out, parentPath, strlen(parentPath));
+    *out++ = '/';
+    out = formatJsonText(out, name, strlen(name));
+    out = formatLiteral(out, "\",\"size\":");
+    out = formatUnsigned(out, fileSize, 1);
+    out = formatLiteral(out, ",\"runs\":[");
+    for (size_t i = 0; i < runCount; i++)
+    {
+      out = formatLiteral(out, i == 0 ? "[" : ",[");
+      out = formatUnsigned(out, runs[i].firstCluster, 1);
+      *out++ = ',';
+      out = formatUnsigned(out, runs[i].clusterCount, 1);
+      *out++ = ']';
+    }
+    out = formatLiteral(out, "]}\n");
   }
-  else if (whence == SEEK_END)
+  else
   {
-    // Calculate the file size
-    size_t fileSize = file->fileSize;
-
-    // Update the current cluster offset based on the file size and offset
-    file->currentClusterOffset = fileSize - offset;
+    out += sprintf(out, "%-9s   %-11s   %-10u   %s/%s   ", kind, status, fileSize, parentPath, name);
+    for (size_t i = 0; i < runCount; i++)
+    {
+      out += sprintf(out, "%s%zu-%zu", i == 0 ? "" : ",", runs[i].firstCluster, runs[i].firstCluster + runs[i].clusterCount - 1);
+    }
+    *out++ = '\n';
   }
 
-  // Update the current cluster based on the offset
-  size_t clusterIndex = file->currentClusterOffset / (bootSector.BPB_BytsPerSec * bootSector.BPB_SecPerClus);
+  output->used += out - start;
+}
 
-  // Check if the clusterIndex is within the bounds of the clusterArray
-  if (clusterIndex < file->clusterArraySize)
+// Function to make a name read from the image safe to use as a host file name
+void sanitizeFileName(char *name)
+{
+  if (name[0] == '\0')
   {
-    file->currentCluster = file->clusterArray[clusterIndex];
+    strcpy(name, "_");
   }
-  else
+  for (size_t i = 0; name[i] != '\0'; i++)
   {
-    // The seek operation is beyond the end of the file
-    file->currentCluster = 0xfff8; // Set it to an invalid value
+    // No path separators, control characters, or leading dots ("." and ".." included)
+    if (name[i] == '/' || (unsigned char)name[i] < 0x20 || (name[i] == '.' && i == 0))
+    {
+      name[i] = '_';
+    }
   }
-
-  return file->currentClusterOffset;
 }
 
-// Read data from the file into the buffer
-size_t readFile(File *file, void *buffer, size_t length)
+// Function to copy the clusters of a recovered file out of the image
+void extractClusterRuns(Volume *volume, RecoveryState *state, const char *name, uint32_t fileSize, const ClusterRun *runs, size_t runCount)
 {
-  BootSector bootEntries = *(file->bootEntries);
-  size_t bytesRead = 0; // Total bytes read
-
-  while (file->currentCluster < 0xfff8 && bytesRead < length)
+  size_t bytesPerCluster = volume->bootEntries->BPB_BytsPerSec * volume->bootEntries->BPB_SecPerClus;
+  size_t pathLength = strlen(state->outputDirectory) + 1 + strlen(name) + 1;
+  char *outputPath = malloc(pathLength);
+  char *buffer = malloc(OUTPUT_BUFFER_SIZE);
+  if (outputPath == NULL || buffer == NULL)
   {
-    // Calculate the offset within the current cluster
-    off_t clusterOffset = file->currentClusterOffset % (bootEntries.BPB_BytsPerSec * bootEntries.BPB_SecPerClus);
-
-    // Calculate the offset within the data area
-    off_t dataOffset = file->dataAreaStart + ((file->currentCluster - 2) * bootEntries.BPB_BytsPerSec * bootEntries.BPB_SecPerClus) + clusterOffset;
-
-    // Calculate the number of bytes available in the current cluster
-    size_t bytesAvailable = (bootEntries.BPB_BytsPerSec * bootEntries.BPB_SecPerClus) - clusterOffset;
-
-    // Calculate the number of bytes to read in this iteration
-    size_t bytesToRead = (length - bytesRead) < bytesAvailable ? (length - bytesRead) : bytesAvailable;
-
-    // Seek to the calculated data offset
-    lseek(file->openedFile, dataOffset, SEEK_SET);
+    perror("Failed to allocate memory for extraction");
+    exit(EXIT_FAILURE);
+  }
 
-    // Read data from the file into the buffer
-    size_t bytesReadFromCluster = read(file->openedFile, (char *)buffer + bytesRead, bytesToRead);
+  snprintf(outputPath, pathLength, "%s/%s", state->outputDirectory, name);
+  int outputFile = open(outputPath, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (outputFile == -1)
+  {
+    // Skip just this file, the rest of the recovery can still succeed
+    fprintf(stderr, "Skipping %s: %s\n", outputPath, strerror(errno));
+    free(buffer);
+    free(outputPath);
+    return;
+  }
 
-    // Update the current cluster offset and total bytes read
-    file->currentClusterOffset += bytesReadFromCluster;
-    bytesRead += bytesReadFromCluster;
+  size_t remaining = fileSize;
+  for (size_t i = 0; i < runCount && remaining > 0; i++)
+  {
+    off_t offset = volume->dataAreaStart + (off_t)(runs[i].firstCluster - 2) * bytesPerCluster;
+    size_t runBytes = runs[i].clusterCount * bytesPerCluster;
+    if (runBytes > remaining)
+    {
+      runBytes = remaining;
+    }
 
-    // Move to the next cluster in the FAT chain
-    file->currentCluster = file->fatEntries[file->currentCluster];
+    // Each run is copied in large sequential reads
+    while (runBytes > 0)
+    {
+      size_t blockSize = runBytes < OUTPUT_BUFFER_SIZE ? runBytes : OUTPUT_BUFFER_SIZE;
+      ssize_t bytesRead = readSector(volume->openedFile, buffer, offset, blockSize);
+      if (bytesRead <= 0)
+      {
+        runBytes = 0;
+        remaining = 0;
+        break;
+      }
+      writeAll(outputFile, buffer, bytesRead);
+      offset += bytesRead;
+      runBytes -= bytesRead;
+      remaining -= bytesRead;
+    }
   }
 
-  return bytesRead;
+  close(outputFile);
+  free(buffer);
+  free(outputPath);
 }
 
-// Close the file and free resources
-void closeFile(File *file)
+// Function to report, and optionally extract, the deleted entries below a directory (cluster 0 is the root directory)
+// Everything inside a deleted directory is treated as deleted
+void recoverDirectory(Volume *volume, RecoveryState *state, uint16_t directoryCluster, const char *path, uint16_t depth, int insideDeleted)
 {
-  // Free the data
-  free(file->clusterArray);
-  free(file);
-}
+  BootSector *bootSector = volume->bootEntries;
 
-// Temporary integer to hold current directory index
-int newDirectoryIndex = 0;
+  // Deleted entries are decoded too, only one cluster per directory level is held in memory
+  DirectoryIterator *directory = openDirectory(volume, directoryCluster, 1);
+  FullDirectoryEntry *entry;
 
-// Function to find a file/directory in the file system
-FullDirectoryEntry *findDirectoryEntryInDirectory(int openedFile, BootSector *bootSector, uint16_t *fatEntries, off_t dataAreaStart, FullDirectoryEntry *parentDirectory, int *currentDirectoryIndex, const char *name)
-{
-  // Iterate through the directory entries in the parent directory
-  for (size_t i = *currentDirectoryIndex; i < numRootDirectoryEntries; ++i)
+  while ((entry = readDirectory(directory)) != NULL)
   {
-    FullDirectoryEntry *entry = &parentDirectory[i];
+    // Skip the volume label and the dot entries of sub directories
+    if ((entry->DIR_Attr & 0x08) || strcmp(entry->DIR_Name, ".") == 0 || strcmp(entry->DIR_Name, "..") == 0)
+    {
+      continue;
+    }
 
-    // Check if the current entry matches the desired name based on either long name or short name
-    if ((strcmp(entry->DIR_Name, name) == 0) || strncmp(entry->shortDIR_Name, name, strlen(name)) == 0)
+    int descend = 0;
+    if (entry->deleted || insideDeleted)
     {
-      // If the entry is a subdirectory, recursively search inside it and populate global array
-      if ((entry->DIR_Attr & 0x10) && !(entry->DIR_Attr & 0x08))
+      ClusterRun *runs = NULL;
+      size_t runCount = 0;
+      const char *status = "empty";
+
+      if (!(entry->DIR_Attr & 0x10) && entry->DIR_FileSize > 0)
       {
-        size_t clusterValue = entry->DIR_FstClusLO;
-        newDirectoryIndex = numRootDirectoryEntries;
+        size_t bytesPerCluster = bootSector->BPB_BytsPerSec * bootSector->BPB_SecPerClus;
+        size_t clustersFound = 0;
+        runCount = reconstructClusterRuns(volume, state, entry->DIR_FstClusLO, entry->DIR_FileSize, &runs);
+        for (size_t j = 0; j < runCount; j++)
+        {
+          clustersFound += runs[j].clusterCount;
+        }
 
-        // Loop to prevent overlap from exisiting entries
-        if (clusterValue == 0)
+        if (runCount == 0)
+        {
+          status = "overwritten";
+        }
+        else if (clustersFound * bytesPerCluster < entry->DIR_FileSize)
         {
-          newDirectoryIndex = 0;
+          status = "partial";
         }
         else
         {
-          // Replace the fixed-size array checks with dynamic allocation
-          if (clusterCheckArraySize == 0)
-          {
-            clusterCheckArraySize = 100; // Initial size
-            clusterCheckArray = malloc(clusterCheckArraySize * sizeof(size_t));
-            directoryNumbers = malloc(clusterCheckArraySize * sizeof(int));
-            if (clusterCheckArray == NULL || directoryNumbers == NULL)
-            {
-              perror("Failed to allocate memory for cluster arrays");
-              exit(EXIT_FAILURE);
-            }
-          }
-
-          // Check if clusterValue already exists in clusterCheckArray
-          int existingIndex = -1;
-          for (size_t i = 0; i < clusterCheckArraySize; i++)
-          {
-            if (clusterCheckArray[i] == clusterValue)
-            {
-              existingIndex = i;
-              break;
-            }
-          }
-
-          if (existingIndex != -1)
-          {
-            // If clusterValue already exists, update newDirectoryIndex
-            newDirectoryIndex = directoryNumbers[existingIndex];
-          }
-          else
-          {
-            // If not, add the current clusterValue and newDirectoryIndex to the arrays
-            size_t i;
-            for (i = 0; i < clusterCheckArraySize; i++)
-            {
-              if (clusterCheckArray[i] == 0)
-              {
-                // Check if we need to expand the arrays
-                if (i == clusterCheckArraySize - 1)
-                {
-                  clusterCheckArraySize *= 2;
-                  clusterCheckArray = realloc(clusterCheckArray, clusterCheckArraySize * sizeof(size_t));
-                  directoryNumbers = realloc(directoryNumbers, clusterCheckArraySize * sizeof(int));
-                  if (clusterCheckArray == NULL || directoryNumbers == NULL)
-                  {
-                    perror("Failed to reallocate memory for cluster arrays");
-                    exit(EXIT_FAILURE);
-                  }
-                }
-                directoryNumbers[i] = newDirectoryIndex;
-                clusterCheckArray[i] = clusterValue;
-
-                // Go through the cluster chain and populate array with its entries
-                while (clusterValue < 0xfff8)
-                {
-                  uint16_t bytesPerCluster = bootSector->BPB_SecPerClus * bootSector->BPB_BytsPerSec;
-                  off_t testOffset = calculateByteOffset(clusterValue, bytesPerCluster, dataAreaStart);
-                  size_t numEntries = bytesPerCluster / sizeof(DirectoryEntry);
-
-                  processDirectoryEntries(openedFile, testOffset, numEntries);
-                  clusterValue = fatEntries[clusterValue];
-                }
-                break;
-              }
-            }
-          }
+          status = runCount == 1 ? "contiguous" : "fragmented";
         }
-        // Return found entry
-        return entry;
       }
-      else
+      else if (entry->DIR_Attr & 0x10)
+      {
+        status = "directory";
+
+        // The chain of a deleted directory is gone, but its first cluster may still hold its entries
+        if (isRecoverableCluster(volume, state, entry->DIR_FstClusLO))
+        {
+          state->claimedClusters[entry->DIR_FstClusLO] = 1;
+          descend = 1;
+        }
+      }
+
+      outputRecovery(&standardOutput, "deleted", status, path, entry->DIR_Name, entry->DIR_FileSize, runs, runCount);
+      if (state->outputDirectory != NULL && runCount > 0)
       {
-        // Return the found entry
-        return entry;
+        // Prefix the first cluster so files with the same name do not collide
+        char fileName[sizeof(entry->DIR_Name) + 16];
+        sanitizeFileName(entry->DIR_Name);
+        snprintf(fileName, sizeof(fileName), "%zu_%s", runs[0].firstCluster, entry->DIR_Name);
+        extractClusterRuns(volume, state, fileName, entry->DIR_FileSize, runs, runCount);
       }
+      free(runs);
+    }
+    else if ((entry->DIR_Attr & 0x10) && entry->DIR_FstClusLO >= 2)
+    {
+      descend = 1;
+    }
+
+    if (descend && depth < MAX_WALK_DEPTH)
+    {
+      size_t pathLength = strlen(path) + 1 + strlen(entry->DIR_Name) + 1;
+      char *childPath = malloc(pathLength);
+      if (childPath == NULL)
+      {
+        perror("Failed to allocate memory for path");
+        exit(EXIT_FAILURE);
+      }
+      snprintf(childPath, pathLength, "%s/%s", path, entry->DIR_Name);
+
+      recoverDirectory(volume, state, entry->DIR_FstClusLO, childPath, depth + 1, insideDeleted || entry->deleted);
+      free(childPath);
+    }
+  }
+
+  closeDirectory(directory);
+}
+
+// Function to find the known file signature a cluster starts with
+const FileSignature *matchFileSignature(const uint8_t *data)
+{
+  static uint32_t prefixValues[NUM_FILE_SIGNATURES];
+  static uint32_t prefixMasks[NUM_FILE_SIGNATURES];
+  static int prefixesReady = 0;
+
+  // Turn the first four bytes of every signature into a value and mask for a single word compare
+  if (!prefixesReady)
+  {
+    for (size_t i = 0; i < NUM_FILE_SIGNATURES; i++)
+    {
+      uint8_t value[4] = {0}, mask[4] = {0};
+      for (size_t j = 0; j < 4 && j < fileSignatures[i].length; j++)
+      {
+        value[j] = fileSignatures[i].magic[j];
+        mask[j] = 0xFF;
+      }
+      memcpy(&prefixValues[i], value, 4);
+      memcpy(&prefixMasks[i], mask, 4);
+    }
+    prefixesReady = 1;
+  }
+
+  uint32_t prefix;
+  memcpy(&prefix, data, sizeof(prefix));
+  for (size_t i = 0; i < NUM_FILE_SIGNATURES; i++)
+  {
+    if ((prefix & prefixMasks[i]) == prefixValues[i] &&
+        (fileSignatures[i].length <= 4 || memcmp(data + 4, fileSignatures[i].magic + 4, fileSignatures[i].length - 4) == 0) &&
+        (fileSignatures[i].form == NULL || memcmp(data + 8, fileSignatures[i].form, 4) == 0))
+    {
+      return &fileSignatures[i];
     }
   }
 
-  // If the entry is not found, return NULL
   return NULL;
 }
 
-// Function to find a directory entry based on the given path recursively
-FullDirectoryEntry *findDirectoryEntryByPath(int openedFile, BootSector *bootSector, uint16_t *fatEntries, off_t dataAreaStart, const char *path)
+// Function to report, and optionally extract, a carved run of free clusters
+void finishCarvedRun(Volume *volume, RecoveryState *state, const FileSignature *signature, ClusterRun *run)
 {
-  // Split the path into individual components
-  char *token, *pathCopy;
-  pathCopy = strdup(path);
-  token = strtok_r(pathCopy, "/", &pathCopy);
+  size_t bytesPerCluster = volume->bootEntries->BPB_BytsPerSec * volume->bootEntries->BPB_SecPerClus;
+  char name[32];
+  snprintf(name, sizeof(name), "carved_%zu.%s", run->firstCluster, signature->extension);
+
+  // The real length is unknown, so the whole run is reported
+  uint32_t runBytes = run->clusterCount * bytesPerCluster;
+  outputRecovery(&standardOutput, "carved", signature->extension, "", name, runBytes, run, 1);
+  if (state->outputDirectory != NULL)
+  {
+    extractClusterRuns(volume, state, name, runBytes, run, 1);
+  }
 
-  // Temporary entry to hold the returned value
-  FullDirectoryEntry *currentEntry = fullEntry;
-  newDirectoryIndex = 0;
+  run->clusterCount = 0;
+}
 
-  while (1)
+// Function to scan the free clusters of a volume for the start of known file types
+void carveFreeClusters(Volume *volume, RecoveryState *state)
+{
+  size_t bytesPerCluster = volume->bootEntries->BPB_BytsPerSec * volume->bootEntries->BPB_SecPerClus;
+  size_t clustersPerRead = CARVE_READ_SIZE / bytesPerCluster;
+  size_t endCluster = state->clusterCount + 2;
+  uint8_t *buffer = malloc(clustersPerRead * bytesPerCluster);
+  if (buffer == NULL)
   {
-    // Recursive call to find the next entry
-    currentEntry = findDirectoryEntryInDirectory(openedFile, bootSector, fatEntries, dataAreaStart, fullEntry, &newDirectoryIndex, token);
+    perror("Failed to allocate memory for carving buffer");
+    exit(EXIT_FAILURE);
+  }
+
+  ClusterRun run = {0, 0};
+  const FileSignature *runSignature = NULL;
+
+  for (size_t chunkStart = 2; chunkStart < endCluster; chunkStart += clustersPerRead)
+  {
+    size_t chunkEnd = chunkStart + clustersPerRead < endCluster ? chunkStart + clustersPerRead : endCluster;
 
-    if (NULL == currentEntry)
+    // Only read the span between the first and last candidate cluster of the chunk
+    size_t first = chunkStart;
+    while (first < chunkEnd && !isRecoverableCluster(volume, state, first))
     {
-      // does not exist
-      return currentEntry;
+      first++;
     }
-    else
+    if (first == chunkEnd)
+    {
+      if (run.clusterCount > 0)
+      {
+        finishCarvedRun(volume, state, runSignature, &run);
+      }
+      continue;
+    }
+    size_t last = chunkEnd;
+    while (!isRecoverableCluster(volume, state, last - 1))
+    {
+      last--;
+    }
+
+    off_t offset = volume->dataAreaStart + (off_t)(first - 2) * bytesPerCluster;
+    ssize_t bytesRead = readSector(volume->openedFile, buffer, offset, (last - first) * bytesPerCluster);
+    if (bytesRead < 0)
+    {
+      break;
+    }
+    size_t clustersRead = bytesRead / bytesPerCluster;
+
+    for (size_t cluster = chunkStart; cluster < chunkEnd; cluster++)
     {
-      // Check if returned entry is a directory or not
-      if ((currentEntry->DIR_Attr & 0x10) && !(currentEntry->DIR_Attr & 0x08))
+      if (!isRecoverableCluster(volume, state, cluster) || cluster - first >= clustersRead)
       {
-        // Get the next token
-        token = strtok_r(NULL, "/", &pathCopy);
-        if (NULL == token)
+        if (run.clusterCount > 0)
         {
-          // If end of string
-          return currentEntry;
+          finishCarvedRun(volume, state, runSignature, &run);
         }
+        continue;
       }
-      else
+
+      // A new signature ends the current run and starts another, a never written cluster just ends it
+      const uint8_t *data = buffer + (cluster - first) * bytesPerCluster;
+      const FileSignature *signature = matchFileSignature(data);
+      if (signature == NULL && run.clusterCount > 0 && data[0] == 0 && memcmp(data, data + 1, bytesPerCluster - 1) == 0)
+      {
+        finishCarvedRun(volume, state, runSignature, &run);
+      }
+      else if (signature != NULL)
+      {
+        if (run.clusterCount > 0)
+        {
+          finishCarvedRun(volume, state, runSignature, &run);
+        }
+        run.firstCluster = cluster;
+        run.clusterCount = 1;
+        runSignature = signature;
+      }
+      else if (run.clusterCount > 0)
       {
-        return currentEntry;
+        run.clusterCount++;
       }
     }
   }
+
+  if (run.clusterCount > 0)
+  {
+    finishCarvedRun(volume, state, runSignature, &run);
+  }
+
+  free(buffer);
 }
 
-// Function to print the decoded values of a found entry and its content
-void processEntry(Volume *volume, FullDirectoryEntry *newEntry, FullDirectoryEntry *fullEntry, int numRootDirectoryEntries, int newDirectoryIndex, const char *newFilePath)
+// Function to report the deleted files of a volume and optionally carve its free space
+void recoverVolume(Volume *volume, const char *outputDirectory)
 {
-  if (newEntry != NULL)
+  RecoveryState state;
+  state.clusterCount = countDataClusters(volume);
+  state.claimedClusters = calloc(state.clusterCount + 2, 1);
+  state.outputDirectory = outputDirectory;
+  if (state.claimedClusters == NULL)
   {
-    printf("\nEntry found for path: %s\n\n", newFilePath);
-    printf(headerFormat, "First Cluster", "Last Modified Time", "Last Modified Date", "Attributes", "Length", "FileName");
+    perror("Failed to allocate memory for cluster map");
+    exit(EXIT_FAILURE);
+  }
+
+  if (outputFormat == FORMAT_TABLE)
+  {
+    printf("%-9s   %-11s   %-10s   %s   %s\n", "Kind", "Status", "Length", "Path", "Clusters");
     printf("--------------------------------------------------");
     printf("----------------------------------------------------\n");
-    printFile(newEntry);
+  }
 
-    printf("\n==================================================");
-    printf("====================================================");
-    printf("\nCONTENTS OF %s\n", newEntry->DIR_Name);
+  recoverDirectory(volume, &state, 0, "", 0, 0);
+  if (carveFreeSpace)
+  {
+    carveFreeClusters(volume, &state);
+  }
+  outputFlush(&standardOutput);
 
-    // If its a directory prints its sub content (files or directories)
-    if ((newEntry->DIR_Attr & 0x10) && !(newEntry->DIR_Attr & 0x08))
+  free(state.claimedClusters);
+}
+
+// Function to print the command line usage and exit
+void printUsage(const char *programName)
+{
+  fprintf(stderr, "Usage: %s [--trace <file>] <path to fat16 image>\n", programName);
+  fprintf(stderr, "       --trace <file> writes Chrome trace-event JSON of where time was spent, for any mode\n");
+  fprintf(stderr, "       %s [--format table|jsonl|binary] walk <path to fat16 image>\n", programName);
+  fprintf(stderr, "       %s pack <host directory> <path to new fat16 image>\n", programName);
+  fprintf(stderr, "       %s [--format table|jsonl] [--carve] recover <path to fat16 image> [output directory]\n", programName);
+  exit(EXIT_FAILURE);
+}
+
+int main(int argc, char *argv[])
+{
+  // Parse the options in front of the mode and image arguments
+  int argIndex = 1;
+  while (argIndex < argc && strncmp(argv[argIndex], "--", 2) == 0)
+  {
+    if (strcmp(argv[argIndex], "--format") == 0 && argIndex + 1 < argc)
     {
-      for (int x = 0; x < numRootDirectoryEntries; x++)
+      const char *format = argv[argIndex + 1];
+      if (strcmp(format, "table") == 0)
       {
-        if (strcmp(fullEntry[x].DIR_Name, newEntry->DIR_Name) == 0)
-        {
-          for (int y = newDirectoryIndex; y < numRootDirectoryEntries; y++)
-          {
-            printFile(&fullEntry[y]);
-          }
-        }
+        outputFormat = FORMAT_TABLE;
       }
-    }
-    else // Else print the files output
-    {
-      File *file = openFile(volume, newEntry);
-
-      // Seek to the beginning of the file
-      seekFile(file, 0, SEEK_SET);
-
-      // Ask the user for the buffer size
-      size_t bufferSize;
-      printf("Enter the buffer size: ");
-      scanf("%zu", &bufferSize);
-
-      // Read and print the content of the file
-      char *buffer = (char *)malloc(bufferSize);
-      if (buffer == NULL)
+      else if (strcmp(format, "jsonl") == 0)
       {
-        perror("Error allocating memory for buffer");
-        exit(EXIT_FAILURE);
+        outputFormat = FORMAT_JSONL;
       }
-
-      size_t bytesRead = readFile(file, buffer, bufferSize);
-
-      // Print the data read from the file
-      for (size_t i = 0; i < bytesRead; ++i)
+      else if (strcmp(format, "binary") == 0)
       {
-        printf("%c", buffer[i]);
+        outputFormat = FORMAT_BINARY;
       }
-      printf("\n");
+      else
+      {
+        printUsage(argv[0]);
+      }
+      argIndex += 2;
+    }
+    else if (strcmp(argv[argIndex], "--trace") == 0 && argIndex + 1 < argc)
+    {
+      // Spans are written out when the program exits, whichever way it does
+      tracingEnabled = 1;
+      traceFilePath = argv[argIndex + 1];
+      traceStartTime = traceNow();
+      atexit(writeTraceFile);
+      argIndex += 2;
+    }
+    else if (strcmp(argv[argIndex], "--carve") == 0)
+    {
+      carveFreeSpace = 1;
+      argIndex++;
+    }
+    else
+    {
+      printUsage(argv[0]);
+    }
+  }
 
-      // Free allocated memory
-      free(buffer);
+  // Check if command line arguements are correct
+  int walkMode = 0, recoverMode = 0;
+  const char *recoverDirectory = NULL;
+  if (argc - argIndex == 2 && strcmp(argv[argIndex], "walk") == 0)
+  {
+    walkMode = 1;
+    argIndex++;
+  }
+  else if ((argc - argIndex == 2 || argc - argIndex == 3) && strcmp(argv[argIndex], "recover") == 0)
+  {
+    if (outputFormat == FORMAT_BINARY)
+    {
+      printUsage(argv[0]);
     }
+    recoverMode = 1;
+    recoverDirectory = argc - argIndex == 3 ? argv[argIndex + 2] : NULL;
+    argIndex++;
   }
-  else
+  else if (argc - argIndex == 3 && strcmp(argv[argIndex], "pack") == 0)
   {
-    printf("Entry not found for path: %s\n", newFilePath);
+    return packImage(argv[argIndex + 1], argv[argIndex + 2]);
   }
-}
-
-int main(int argc, char *argv[])
-{
-  // Check if command line arguements are correct
-  if (argc != 2)
+  else if (argc - argIndex != 1 || outputFormat != FORMAT_TABLE)
   {
-    fprintf(stderr, "Usage: %s <path to fat16 image>\n", argv[0]);
-    exit(EXIT_FAILURE);
+    // The interactive mode mixes prompts and file contents into its output, so it only prints tables
+    printUsage(argv[0]);
   }
 
   // FAT16 filepath
-  const char *filePath = argv[1];
+  const char *filePath = argv[argIndex];
 
   // Open the fat16 file
   int openedFile = open(filePath, O_RDONLY);
@@ -719,11 +3361,18 @@ int main(int argc, char *argv[])
     exit(EXIT_FAILURE);
   }
 
+  // Compressed images are read through their chunk index
+  uint64_t traceStart = traceBegin();
+  compressedImage = openCompressedImage(openedFile, filePath);
+  traceEnd("check for compressed image", NULL, -1, traceStart);
+
   // Task 2
 
   // Read the Boot Sector to get necessary information
   BootSector bootSector;
+  traceStart = traceBegin();
   readSector(openedFile, &bootSector, 0, sizeof(BootSector));
+  traceEnd("load boot sector", NULL, -1, traceStart);
 
   // Task 3
 
@@ -735,37 +3384,63 @@ int main(int argc, char *argv[])
 
   // Allocate memory to store FAT entries
   uint16_t *fatEntries = malloc(fatSize);
+  traceStart = traceBegin();
   readSector(openedFile, fatEntries, fatStart, fatSize);
+  traceEnd("load FAT", NULL, fatSize, traceStart);
 
-  // Task 4
-
-  // Calculate the start of the root directory
-  off_t rootDirStart = (bootSector.BPB_RsvdSecCnt + bootSector.BPB_NumFATs * bootSector.BPB_FATSz16) * bootSector.BPB_BytsPerSec;
+  off_t dataAreaStart = (bootSector.BPB_RsvdSecCnt + bootSector.BPB_NumFATs * bootSector.BPB_FATSz16 + (bootSector.BPB_RootEntCnt * sizeof(DirectoryEntry) + bootSector.BPB_BytsPerSec - 1) / bootSector.BPB_BytsPerSec) * bootSector.BPB_BytsPerSec;
+  Volume *volume = createVolume(openedFile, &bootSector, fatEntries, fatSize, dataAreaStart);
 
-  // Set the file pointer to the start of the root directory
-  lseek(openedFile, rootDirStart, SEEK_SET);
+  // Recursively list the whole volume without prompting
+  if (walkMode)
+  {
+    tableShowsPath = 1;
+    printListingHeader();
+    walkDirectory(volume, 0, "", 0);
+    outputFlush(&standardOutput);
+
+    free(volume);
+    free(fatEntries);
+    if (compressedImage != NULL)
+    {
+      closeCompressedImage(compressedImage);
+    }
+    close(openedFile);
+    return 0;
+  }
 
-  // Calculate the number of entries in the root directory
-  uint16_t bytesPerCluster = bootSector.BPB_SecPerClus * bootSector.BPB_BytsPerSec; // Calculate bytes per cluster
-  size_t numEntries = bytesPerCluster / sizeof(DirectoryEntry);
+  // Report deleted files without prompting
+  if (recoverMode)
+  {
+    recoverVolume(volume, recoverDirectory);
 
-  // Process directory entries using the separate function
-  processDirectoryEntries(openedFile, rootDirStart, numEntries);
+    free(volume);
+    free(fatEntries);
+    if (compressedImage != NULL)
+    {
+      closeCompressedImage(compressedImage);
+    }
+    close(openedFile);
+    return 0;
+  }
 
-  off_t dataAreaStart = (bootSector.BPB_RsvdSecCnt + bootSector.BPB_NumFATs * bootSector.BPB_FATSz16 + (bootSector.BPB_RootEntCnt * sizeof(DirectoryEntry) + bootSector.BPB_BytsPerSec - 1) / bootSector.BPB_BytsPerSec) * bootSector.BPB_BytsPerSec;
+  // Task 4
 
-  // Print the root directory contents
+  // Print the root directory contents as each piece of it is decoded
   printf("\nRoot Directory Contents:\n");
-  printf(headerFormat, "First Cluster", "Last Modified Time", "Last Modified Date", "Attributes", "Length", "FileName");
-  printf("--------------------------------------------------");
-  printf("----------------------------------------------------\n");
-  for (size_t i = 0; i < numRootDirectoryEntries; i++)
+  printListingHeader();
+  DirectoryIterator *rootDirectory = openDirectory(volume, 0, 0);
+  FullDirectoryEntry *rootEntry;
+  while ((rootEntry = readDirectory(rootDirectory)) != NULL)
   {
-    if (fullEntry[i].DIR_Name[0] != 0 && fullEntry[i].DIR_Name[0] != 0xE5)
+    printFile(rootEntry, "", 0, 0);
+    if (directoryClusterDone(rootDirectory))
     {
-      printFile(&fullEntry[i]);
+      outputFlush(&standardOutput);
     }
   }
+  closeDirectory(rootDirectory);
+  outputFlush(&standardOutput);
   printf("\n");
 
   // Taking in user input for file path
@@ -780,14 +3455,19 @@ int main(int argc, char *argv[])
     newFilePath[len - 1] = '\0';
   }
 
-  Volume *volume = createVolume(openedFile, &bootSector, fatEntries, fatSize, dataAreaStart);
-  FullDirectoryEntry *newEntry = findDirectoryEntryByPath(openedFile, &bootSector, fatEntries, dataAreaStart, newFilePath);
-  processEntry(volume, newEntry, fullEntry, numRootDirectoryEntries, newDirectoryIndex, newFilePath);
+  FullDirectoryEntry foundEntry;
+  FullDirectoryEntry *newEntry = findDirectoryEntryByPath(volume, newFilePath, &foundEntry);
+  processEntry(volume, newEntry, newFilePath);
 
   // Free allocated memory
+  free(volume);
   free(fatEntries);
 
   // Close the file
+  if (compressedImage != NULL)
+  {
+    closeCompressedImage(compressedImage);
+  }
   close(openedFile);
 
   return 0;